@@ -0,0 +1,133 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+/**
+ * @Brief Round n up to the arena alignment
+ */
+static size_t align_up(size_t n)
+{
+  return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+/**
+ * @Brief Allocate a block that can hold at least n bytes
+ */
+static ArenaBlock *block_new(size_t size)
+{
+  ArenaBlock *b = malloc(sizeof(ArenaBlock) + size);
+  if (!b)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  b->next = NULL;
+  b->size = size;
+  b->used = 0;
+  return b;
+}
+
+/**
+ * @Brief Allocate n bytes from the arena
+ *
+ * Moves on to the next retained block when the current one is full, and
+ * only asks the heap for a new block when none of the retained ones fit.
+ *
+ * @param a The arena
+ * @param n Number of bytes
+ * @return Pointer aligned for any type
+ */
+void *arena_alloc(Arena *a, size_t n)
+{
+  n = align_up(n ? n : 1);
+  if (!a->cur)
+  {
+    a->first = a->cur = block_new(n > a->block_size ? n : a->block_size);
+  }
+  while (a->cur->size - a->cur->used < n)
+  {
+    ArenaBlock *next = a->cur->next;
+    if (!next || next->size < n)
+    {
+      // Splice a fresh block in after the current one
+      ArenaBlock *b = block_new(n > a->block_size ? n : a->block_size);
+      b->next = next;
+      a->cur->next = b;
+      next = b;
+    }
+    next->used = 0;
+    a->cur = next;
+  }
+  void *p = a->cur->data + a->cur->used;
+  a->cur->used += n;
+  a->last = p;
+  return p;
+}
+
+/**
+ * @Brief Resize an arena allocation
+ *
+ * The latest allocation is extended in place when its block has room;
+ * anything else is copied to a new allocation (the old bytes stay in the
+ * arena until the next reset).
+ */
+void *arena_realloc(Arena *a, void *ptr, size_t old_n, size_t new_n)
+{
+  if (!ptr)
+    return arena_alloc(a, new_n);
+  if (ptr == a->last)
+  {
+    size_t start = (size_t)((char *)ptr - a->cur->data);
+    if (start + align_up(new_n) <= a->cur->size)
+    {
+      a->cur->used = start + align_up(new_n ? new_n : 1);
+      return ptr;
+    }
+  }
+  void *p = arena_alloc(a, new_n);
+  memcpy(p, ptr, old_n < new_n ? old_n : new_n);
+  return p;
+}
+
+/**
+ * @Brief Copy n bytes of s into the arena as a NUL terminated string
+ */
+char *arena_strndup(Arena *a, const char *s, size_t n)
+{
+  char *p = arena_alloc(a, n + 1);
+  memcpy(p, s, n);
+  p[n] = '\0';
+  return p;
+}
+
+/**
+ * @Brief Release every allocation at once
+ *
+ * Only the cursor moves; blocks are kept and reused by later allocations.
+ */
+void arena_reset(Arena *a)
+{
+  a->cur = a->first;
+  a->last = NULL;
+  if (a->cur)
+    a->cur->used = 0;
+}
+
+/**
+ * @Brief Return all arena memory to the heap
+ */
+void arena_free(Arena *a)
+{
+  ArenaBlock *b = a->first;
+  while (b)
+  {
+    ArenaBlock *next = b->next;
+    free(b);
+    b = next;
+  }
+  a->first = a->cur = NULL;
+  a->last = NULL;
+}
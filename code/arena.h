@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// One chunk of arena memory
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;  // usable bytes in data
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+// Bump allocator for short-lived allocations. Blocks are kept across resets,
+// so once it has warmed up an arena serves requests without touching the heap.
+typedef struct {
+    ArenaBlock *first;
+    ArenaBlock *cur;
+    void *last;       // most recent allocation (can be grown in place)
+    size_t block_size;
+} Arena;
+
+#define ARENA_INIT(block_size) {NULL, NULL, NULL, (block_size)}
+
+// Allocate n bytes aligned for any type. Never returns NULL (exits on OOM).
+void *arena_alloc(Arena *a, size_t n);
+
+// Resize an allocation. Grows in place when ptr is the latest allocation.
+void *arena_realloc(Arena *a, void *ptr, size_t old_n, size_t new_n);
+
+// Copy n bytes of s into the arena and NUL terminate them
+char *arena_strndup(Arena *a, const char *s, size_t n);
+
+// Forget every allocation in O(1); the memory is reused by later calls
+void arena_reset(Arena *a);
+
+// Give all blocks back to the heap
+void arena_free(Arena *a);
+
+#endif // ARENA_H
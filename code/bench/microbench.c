@@ -0,0 +1,490 @@
+/*
+ * Microbenchmarks for the shell's data structures and lexer.
+ *
+ * Reports ops/sec and heap allocations per op for hash_map, dynamic_array,
+ * the string intern table, the string helpers and lex_line at growing sizes, then runs randomized
+ * and adversarial inputs (long quote runs, walls of `|`, huge alias
+ * bodies) at n and SCALE_STEP * n and fails if the time grows faster than
+ * linearly, so a quadratic regression breaks `make microbench`.
+ *
+ * Usage: microbench [-q]   (-q: scaling checks only)
+ */
+#include "arena.h"
+#include "dynamic_array.h"
+#include "hash_map.h"
+#include "intern.h"
+#include "lexer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SCALE_STEP 8      /* size ratio between the two runs of a check */
+#define SCALE_SLACK 3.0   /* allowed time ratio is SCALE_STEP * SCALE_SLACK */
+#define SCALE_REPEAT 5    /* best of, to shave off noise */
+
+/* Counting allocator: every heap call of the process, libc's included */
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t n);
+extern void __libc_free(void *p);
+
+static unsigned long n_allocs = 0; /* malloc, calloc and realloc calls */
+
+void *malloc(size_t n)
+{
+  n_allocs++;
+  return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  n_allocs++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n)
+{
+  n_allocs++;
+  return __libc_realloc(p, n);
+}
+
+void free(void *p)
+{
+  __libc_free(p);
+}
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Small xorshift generator: the same inputs on every run */
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static void check(int ok, const char *what)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "microbench: wrong result in %s\n", what);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void report(const char *name, size_t n, size_t ops, double secs, unsigned long allocs)
+{
+  printf("%-28s %9zu %14.0f %12.2f\n", name, n, ops / secs, (double)allocs / ops);
+}
+
+/* Keys "k<i>" for i < n, in one block */
+static char **make_keys(size_t n)
+{
+  char **keys = malloc(sizeof(char *) * n);
+  char *buf = malloc(n * 24);
+  check(keys && buf, "make_keys");
+  for (size_t i = 0; i < n; i++)
+  {
+    keys[i] = buf + i * 24;
+    snprintf(keys[i], 24, "k%zu", i);
+  }
+  return keys;
+}
+
+static void free_keys(char **keys)
+{
+  free(keys[0]);
+  free(keys);
+}
+
+/***************************************************
+ * Throughput
+ ***************************************************/
+static void bench_hash_map(size_t n)
+{
+  char **keys = make_keys(n);
+  HashMap *hm = hm_create();
+
+  unsigned long a = n_allocs;
+  double t = now_s();
+  for (size_t i = 0; i < n; i++)
+    hm_put(hm, keys[i], "value");
+  report("hm_put", n, n, now_s() - t, n_allocs - a);
+
+  a = n_allocs;
+  t = now_s();
+  size_t hits = 0;
+  for (size_t i = 0; i < n; i++)
+    hits += hm_get(hm, keys[rng() % n]) != NULL;
+  report("hm_get (hit)", n, n, now_s() - t, n_allocs - a);
+  check(hits == n, "hm_get");
+
+  a = n_allocs;
+  t = now_s();
+  for (size_t i = 0; i < n; i++)
+    hits += hm_get(hm, "missing-key") != NULL;
+  report("hm_get (miss)", n, n, now_s() - t, n_allocs - a);
+  check(hits == n, "hm_get miss");
+
+  a = n_allocs;
+  t = now_s();
+  for (size_t i = 0; i < n; i++)
+    hm_delete(hm, keys[i]);
+  report("hm_delete", n, n, now_s() - t, n_allocs - a);
+  check(hm_size(hm) == 0, "hm_delete");
+
+  hm_free(hm);
+  free_keys(keys);
+}
+
+/* The same few command names over and over, then n distinct ones */
+static void bench_intern(size_t n)
+{
+  static const char *names[] = {"ls", "grep", "cat", "wc", "sort", "head", "echo", "/bin/ls"};
+  size_t nnames = sizeof(names) / sizeof(names[0]);
+  char **keys = make_keys(n);
+  InternTable t = INTERN_TABLE_INIT;
+  for (size_t i = 0; i < nnames; i++)
+    intern_cstr(&t, names[i]);
+
+  unsigned long a = n_allocs;
+  double start = now_s();
+  const char *first = intern_cstr(&t, names[0]);
+  size_t same = 0;
+  for (size_t i = 0; i < n; i++)
+    same += intern_cstr(&t, names[i % nnames]) == first;
+  report("intern (repeated)", n, n, now_s() - start, n_allocs - a);
+  check(same == (n + nnames - 1) / nnames && t.size == nnames, "intern repeated");
+
+  a = n_allocs;
+  start = now_s();
+  for (size_t i = 0; i < n; i++)
+    intern_cstr(&t, keys[i]);
+  report("intern (distinct)", n, n, now_s() - start, n_allocs - a);
+  check(t.size == nnames + n, "intern distinct");
+
+  intern_free(&t);
+  free_keys(keys);
+}
+
+static void bench_dynamic_array(size_t n)
+{
+  DynamicArray *da = da_create(4);
+  unsigned long a = n_allocs;
+  double t = now_s();
+  for (size_t i = 0; i < n; i++)
+    da_put(da, "token");
+  report("da_put", n, n, now_s() - t, n_allocs - a);
+
+  a = n_allocs;
+  t = now_s();
+  for (size_t i = n; i > 0; i--)
+    da_delete(da, i - 1);
+  report("da_delete (last)", n, n, now_s() - t, n_allocs - a);
+  check(da->size == 0, "da_delete");
+  da_free(da);
+}
+
+static void bench_strings(size_t n)
+{
+  char *text = malloc(n + 1);
+  check(text != NULL, "bench_strings");
+  memset(text, 'x', n);
+  text[n] = '\0';
+  text[n / 2] = '$';
+  size_t ops = 1000000 / (n / 64 + 1) + 1;
+
+  unsigned long a = n_allocs;
+  double t = now_s();
+  for (size_t i = 0; i < ops; i++)
+    free(replaceAt(text, n / 2, 1, "value"));
+  report("replaceAt", n, ops, now_s() - t, n_allocs - a);
+
+  a = n_allocs;
+  t = now_s();
+  for (size_t i = 0; i < ops; i++)
+    free(replaceKey(text, "$", "value"));
+  report("replaceKey", n, ops, now_s() - t, n_allocs - a);
+  free(text);
+}
+
+/* A line of n bytes: random words, quotes and pipes */
+static char *random_line(size_t n)
+{
+  static const char *words[] = {"ls", "-l", "'a b c'", "|", "grep", "foo", "'|'", "wc", "-c", "x"};
+  char *line = malloc(n + 32);
+  check(line != NULL, "random_line");
+  size_t len = 0;
+  while (len < n)
+  {
+    const char *w = words[rng() % (sizeof(words) / sizeof(words[0]))];
+    len += (size_t)sprintf(line + len, "%s ", w);
+  }
+  line[len] = '\0';
+  return line;
+}
+
+static void bench_lexer(size_t n)
+{
+  char *line = random_line(n);
+  size_t len = strlen(line);
+  Arena arena = ARENA_INIT(16 * 1024);
+  size_t ops = 10000000 / (len + 1) + 1;
+
+  unsigned long a = n_allocs;
+  double t = now_s();
+  for (size_t i = 0; i < ops; i++)
+  {
+    CommandLine cl;
+    LexStatus st = lex_line(&arena, line, len, 0, &cl);
+    check(st == LEX_OK || st == LEX_EMPTY_SEGMENT, "lex_line");
+    arena_reset(&arena);
+  }
+  report("lex_line (random)", len, ops, now_s() - t, n_allocs - a);
+  arena_free(&arena);
+  free(line);
+}
+
+/***************************************************
+ * Scaling checks
+ ***************************************************/
+typedef double (*scale_fn)(size_t n); /* seconds for one run of size n */
+
+static double lex_input(char *line, size_t len)
+{
+  Arena arena = ARENA_INIT(16 * 1024);
+  CommandLine cl;
+  double t = now_s();
+  lex_line(&arena, line, len, 0, &cl);
+  t = now_s() - t;
+  arena_free(&arena);
+  free(line);
+  return t;
+}
+
+/* 'aaaa...' as a single quoted word */
+static double scale_long_quote(size_t n)
+{
+  char *line = malloc(n + 3);
+  check(line != NULL, "scale_long_quote");
+  line[0] = '\'';
+  memset(line + 1, 'a', n);
+  line[n + 1] = '\'';
+  line[n + 2] = '\0';
+  return lex_input(line, n + 2);
+}
+
+/* 'a' 'a' 'a' ... many short quote runs */
+static double scale_many_quotes(size_t n)
+{
+  char *line = malloc(n * 4 + 1);
+  check(line != NULL, "scale_many_quotes");
+  for (size_t i = 0; i < n; i++)
+    memcpy(line + i * 4, "'a' ", 4);
+  line[n * 4] = '\0';
+  return lex_input(line, n * 4);
+}
+
+/* a|a|a|... one segment per byte pair */
+static double scale_pipes(size_t n)
+{
+  char *line = malloc(n * 2 + 2);
+  check(line != NULL, "scale_pipes");
+  for (size_t i = 0; i < n; i++)
+    memcpy(line + i * 2, "a|", 2);
+  line[n * 2] = 'a';
+  line[n * 2 + 1] = '\0';
+  return lex_input(line, n * 2 + 1);
+}
+
+/* An unterminated quote at the end of a long line */
+static double scale_missing_quote(size_t n)
+{
+  char *line = malloc(n + 2);
+  check(line != NULL, "scale_missing_quote");
+  memset(line, 'a', n);
+  line[n] = '\'';
+  line[n + 1] = '\0';
+  return lex_input(line, n + 1);
+}
+
+static double scale_random_line(size_t n)
+{
+  char *line = random_line(n);
+  return lex_input(line, strlen(line));
+}
+
+/* The alias builtin joins its words: `alias x = 'w w w ... w'` */
+static double scale_alias_join(size_t n)
+{
+  char **words = malloc(sizeof(char *) * n);
+  check(words != NULL, "scale_alias_join");
+  for (size_t i = 0; i < n; i++)
+    words[i] = "word";
+  double t = now_s();
+  char *joined = join_words(words, n, " ");
+  t = now_s() - t;
+  check(strlen(joined) == n * 5 - 1, "join_words");
+  free(joined);
+  free(words);
+  return t;
+}
+
+static double scale_hm_put(size_t n)
+{
+  char **keys = make_keys(n);
+  HashMap *hm = hm_create();
+  double t = now_s();
+  for (size_t i = 0; i < n; i++)
+    hm_put(hm, keys[i], "v");
+  for (size_t i = 0; i < n; i++)
+    hm_delete(hm, keys[i]);
+  t = now_s() - t;
+  hm_free(hm);
+  free_keys(keys);
+  return t;
+}
+
+/* Random put/get/delete mix checked against a plain array */
+static double scale_hm_random(size_t n)
+{
+  char **keys = make_keys(n);
+  char *present = calloc(n, 1);
+  HashMap *hm = hm_create();
+  check(present != NULL, "scale_hm_random");
+  double t = now_s();
+  for (size_t i = 0; i < 4 * n; i++)
+  {
+    size_t k = rng() % n;
+    switch (rng() % 3)
+    {
+    case 0:
+      hm_put(hm, keys[k], keys[k]);
+      present[k] = 1;
+      break;
+    case 1:
+      hm_delete(hm, keys[k]);
+      present[k] = 0;
+      break;
+    default:
+    {
+      char *v = hm_get(hm, keys[k]);
+      check(present[k] ? v && strcmp(v, keys[k]) == 0 : v == NULL, "hm random get");
+      break;
+    }
+    }
+  }
+  t = now_s() - t;
+  size_t expected = 0;
+  for (size_t i = 0; i < n; i++)
+    expected += present[i];
+  check(hm_size(hm) == expected, "hm random size");
+  hm_free(hm);
+  free(present);
+  free_keys(keys);
+  return t;
+}
+
+static double scale_intern(size_t n)
+{
+  char **keys = make_keys(n);
+  InternTable t = INTERN_TABLE_INIT;
+  double start = now_s();
+  for (size_t i = 0; i < 2 * n; i++)
+    intern_cstr(&t, keys[rng() % n]);
+  start = now_s() - start;
+  intern_free(&t);
+  free_keys(keys);
+  return start;
+}
+
+static double scale_da_put(size_t n)
+{
+  DynamicArray *da = da_create(1);
+  double t = now_s();
+  for (size_t i = 0; i < n; i++)
+    da_put(da, "x");
+  t = now_s() - t;
+  da_free(da);
+  return t;
+}
+
+static double best_of(scale_fn fn, size_t n)
+{
+  double best = fn(n);
+  for (int i = 1; i < SCALE_REPEAT; i++)
+  {
+    double t = fn(n);
+    if (t < best)
+      best = t;
+  }
+  return best;
+}
+
+/**
+ * @Brief Check that fn(SCALE_STEP * n) costs at most about SCALE_STEP times fn(n)
+ *
+ * @return 1 if the growth looks linear
+ */
+static int check_linear(const char *name, scale_fn fn, size_t n)
+{
+  double small = best_of(fn, n);
+  double large = best_of(fn, n * SCALE_STEP);
+  double ratio = large / (small > 1e-7 ? small : 1e-7);
+  int ok = ratio <= SCALE_STEP * SCALE_SLACK;
+  printf("%-28s %9zu -> %-9zu %8.2fx %s\n", name, n, n * SCALE_STEP, ratio, ok ? "ok" : "NOT LINEAR");
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  int quick = argc > 1 && strcmp(argv[1], "-q") == 0;
+
+  if (!quick)
+  {
+    printf("%-28s %9s %14s %12s\n", "operation", "size", "ops/sec", "allocs/op");
+    static const size_t sizes[] = {1000, 100000, 1000000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+      bench_hash_map(sizes[i]);
+      bench_intern(sizes[i]);
+      bench_dynamic_array(sizes[i]);
+    }
+    static const size_t lengths[] = {64, 4096, 262144};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+      bench_strings(lengths[i]);
+      bench_lexer(lengths[i]);
+    }
+    printf("\n");
+  }
+
+  printf("%-28s %9s    %-9s %9s\n", "scaling check", "n", "n*step", "time");
+  int ok = 1;
+  ok &= check_linear("lex: one long quote", scale_long_quote, 1 << 17);
+  ok &= check_linear("lex: many quotes", scale_many_quotes, 1 << 15);
+  ok &= check_linear("lex: many pipes", scale_pipes, 1 << 15);
+  ok &= check_linear("lex: missing quote", scale_missing_quote, 1 << 17);
+  ok &= check_linear("lex: random line", scale_random_line, 1 << 16);
+  ok &= check_linear("alias: join words", scale_alias_join, 1 << 15);
+  ok &= check_linear("hm: put+delete", scale_hm_put, 1 << 13);
+  ok &= check_linear("hm: random ops", scale_hm_random, 1 << 13);
+  ok &= check_linear("intern: random", scale_intern, 1 << 13);
+  ok &= check_linear("da: put", scale_da_put, 1 << 14);
+  if (!ok)
+  {
+    fprintf(stderr, "microbench: super-linear growth detected\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
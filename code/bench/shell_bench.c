@@ -0,0 +1,499 @@
+/*
+ * Shell throughput and latency benchmark.
+ *
+ * Generates the standard workloads, runs every shell given on the command
+ * line against them and reports lines/sec, per-command latency and peak
+ * RSS. Results are also written as JSON so runs can be compared across
+ * commits.
+ *
+ * Usage: shell_bench [-s scale] [-o results.json] [-l label] [-w workloads]
+ *                    name=path ...
+ *
+ * Shells whose program name starts with "wsh" get wsh syntax
+ * (alias name = 'value', which); the others get POSIX sh syntax.
+ */
+#define _GNU_SOURCE /* pipe2 */
+#include "launch.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SHELLS 8
+#define MAX_RESULTS 64
+
+#define TRIVIAL_LINES 1000000  /* external commands */
+#define ALIAS_COUNT 256        /* aliases defined by the alias workload */
+#define ALIAS_LINES 200000
+#define BUILTIN_LINES 500000
+#define PIPE_DEPTH 16          /* stages per pipeline */
+#define PIPE_RUNS 8            /* pipelines per script */
+#define PIPE_DATA_MB 64        /* bytes pushed through each pipeline */
+#define LATENCY_CMDS 20000     /* round trips measured one by one */
+
+typedef struct {
+  const char *name;
+  const char *path;
+  int posix;    /* POSIX sh syntax instead of wsh syntax */
+  int pipes;    /* supports `|` (probed) */
+} Shell;
+
+typedef struct {
+  const char *shell;
+  const char *workload;
+  long lines;
+  double wall_s;
+  double user_s;
+  double sys_s;
+  long maxrss_kb;
+  int exit_status;
+  double bytes_per_s; /* pipeline workload only */
+  double p50_us;      /* latency workload only */
+  double p99_us;
+  double max_us;
+  int skipped;
+} Result;
+
+static Result results[MAX_RESULTS];
+static int n_results = 0;
+static char workdir[] = "/tmp/wsh-bench-XXXXXX";
+static double scale = 1.0;
+
+static double now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long scaled(long n)
+{
+  long v = (long)(n * scale);
+  return v > 0 ? v : 1;
+}
+
+static FILE *open_script(char *path, size_t size, const char *workload, const Shell *sh)
+{
+  snprintf(path, size, "%s/%s.%s", workdir, workload, sh->posix ? "sh" : "wsh");
+  FILE *f = fopen(path, "w");
+  if (!f)
+  {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(f, NULL, _IOFBF, 1 << 20);
+  return f;
+}
+
+/* N trivial external commands */
+static long gen_trivial(FILE *f, const Shell *sh)
+{
+  (void)sh;
+  long n = scaled(TRIVIAL_LINES);
+  for (long i = 0; i < n; i++)
+    fputs("/bin/true\n", f);
+  return n;
+}
+
+/* Many aliases, each use expands to a builtin (no process is started) */
+static long gen_alias(FILE *f, const Shell *sh)
+{
+  for (int i = 0; i < ALIAS_COUNT; i++)
+  {
+    if (sh->posix)
+      fprintf(f, "alias a%d='command -v ls'\n", i);
+    else
+      fprintf(f, "alias a%d = 'which ls'\n", i);
+  }
+  long n = scaled(ALIAS_LINES);
+  for (long i = 0; i < n; i++)
+    fprintf(f, "a%ld\n", i % ALIAS_COUNT);
+  return n + ALIAS_COUNT;
+}
+
+/* Builtins only: cd back and forth and command lookups */
+static long gen_builtin(FILE *f, const Shell *sh)
+{
+  const char *lookup = sh->posix ? "command -v ls\n" : "which ls\n";
+  long n = scaled(BUILTIN_LINES);
+  for (long i = 0; i < n; i++)
+  {
+    switch (i % 3)
+    {
+    case 0:
+      fputs("cd /tmp\n", f);
+      break;
+    case 1:
+      fputs("cd /\n", f);
+      break;
+    default:
+      fputs(lookup, f);
+      break;
+    }
+  }
+  return n;
+}
+
+/* Deep pipelines moving a large file */
+static long gen_pipeline(FILE *f, const Shell *sh, long long *bytes)
+{
+  (void)sh;
+  char data[256];
+  snprintf(data, sizeof(data), "%s/pipe.data", workdir);
+  struct stat st;
+  long long size = (long long)(PIPE_DATA_MB * scale * 1024 * 1024);
+  if (size < 1024 * 1024)
+    size = 1024 * 1024;
+  if (stat(data, &st) != 0 || st.st_size != size)
+  {
+    FILE *d = fopen(data, "w");
+    if (!d)
+    {
+      perror(data);
+      exit(EXIT_FAILURE);
+    }
+    const char *line = "the quick brown fox jumps over the lazy dog 0123456789\n";
+    size_t len = strlen(line);
+    for (long long done = 0; done < size; done += (long long)len)
+      fwrite(line, 1, (size_t)(size - done < (long long)len ? size - done : (long long)len), d);
+    fclose(d);
+  }
+
+  for (int r = 0; r < PIPE_RUNS; r++)
+  {
+    fprintf(f, "/bin/cat %s", data);
+    for (int s = 0; s < PIPE_DEPTH - 2; s++)
+      fputs(" | /bin/cat", f);
+    fputs(" | /usr/bin/wc -c\n", f);
+  }
+  *bytes = size * PIPE_RUNS;
+  return PIPE_RUNS;
+}
+
+/* Run shell on script with stdin/stdout on the given descriptors */
+static pid_t start_shell(const Shell *sh, const char *script, int in_fd, int out_fd)
+{
+  char *argv[] = {(char *)sh->path, (char *)script, NULL};
+  LaunchIO io = {.in_fd = in_fd, .out_fd = out_fd};
+  pid_t pid = launch_spawn(sh->path, argv, environ, &io);
+  if (pid < 0)
+  {
+    perror(sh->path);
+    exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+static void finish(Result *r, pid_t pid, double start)
+{
+  int status = 0;
+  struct rusage ru;
+  if (wait4(pid, &status, 0, &ru) < 0)
+  {
+    perror("wait4");
+    exit(EXIT_FAILURE);
+  }
+  r->wall_s = now_s() - start;
+  r->user_s = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+  r->sys_s = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  r->maxrss_kb = ru.ru_maxrss;
+  r->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static Result *new_result(const Shell *sh, const char *workload)
+{
+  if (n_results == MAX_RESULTS)
+  {
+    fprintf(stderr, "too many results\n");
+    exit(EXIT_FAILURE);
+  }
+  Result *r = &results[n_results++];
+  memset(r, 0, sizeof(*r));
+  r->shell = sh->name;
+  r->workload = workload;
+  return r;
+}
+
+/* Throughput: run a generated script with output thrown away */
+static void run_script(const Shell *sh, const char *workload)
+{
+  Result *r = new_result(sh, workload);
+  if (!strcmp(workload, "pipeline") && !sh->pipes)
+  {
+    r->skipped = 1;
+    return;
+  }
+
+  char path[512];
+  long long bytes = 0;
+  FILE *f = open_script(path, sizeof(path), workload, sh);
+  if (!strcmp(workload, "trivial"))
+    r->lines = gen_trivial(f, sh);
+  else if (!strcmp(workload, "alias"))
+    r->lines = gen_alias(f, sh);
+  else if (!strcmp(workload, "builtin"))
+    r->lines = gen_builtin(f, sh);
+  else
+    r->lines = gen_pipeline(f, sh, &bytes);
+  fclose(f);
+
+  int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  double start = now_s();
+  pid_t pid = start_shell(sh, path, null_fd, null_fd);
+  close(null_fd);
+  finish(r, pid, start);
+  if (bytes)
+    r->bytes_per_s = bytes / r->wall_s;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Latency: feed one command at a time and wait for its output */
+static void run_latency(const Shell *sh)
+{
+  Result *r = new_result(sh, "latency");
+  long n = scaled(LATENCY_CMDS);
+  double *lat = malloc(sizeof(double) * (size_t)n);
+  int in[2], out[2];
+  if (!lat || pipe2(in, O_CLOEXEC) != 0 || pipe2(out, O_CLOEXEC) != 0)
+  {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  double start = now_s();
+  pid_t pid = start_shell(sh, "/dev/stdin", in[0], out[1]);
+  close(in[0]);
+  close(out[1]);
+
+  char cmd[64], buf[256];
+  for (long i = 0; i < n; i++)
+  {
+    int len = snprintf(cmd, sizeof(cmd), "/bin/echo %ld\n", i);
+    double t0 = now_s();
+    if (write(in[1], cmd, (size_t)len) != len)
+    {
+      perror("write");
+      break;
+    }
+    // wait for the whole line to come back
+    size_t got = 0;
+    while (got == 0 || buf[got - 1] != '\n')
+    {
+      ssize_t k = read(out[0], buf + got, sizeof(buf) - got);
+      if (k <= 0)
+      {
+        fprintf(stderr, "%s: no output for latency command %ld\n", sh->name, i);
+        n = i;
+        goto done;
+      }
+      got += (size_t)k;
+    }
+    lat[i] = (now_s() - t0) * 1e6;
+  }
+done:
+  close(in[1]);
+  close(out[0]);
+  finish(r, pid, start);
+  r->lines = n;
+  if (n > 0)
+  {
+    qsort(lat, (size_t)n, sizeof(double), cmp_double);
+    r->p50_us = lat[n * 50 / 100];
+    r->p99_us = lat[n * 99 / 100];
+    r->max_us = lat[n - 1];
+  }
+  free(lat);
+}
+
+/* Does the shell run `a | b` as a pipeline? */
+static int probe_pipes(const Shell *sh)
+{
+  char path[512];
+  FILE *f = open_script(path, sizeof(path), "probe", sh);
+  fputs("/bin/echo probe | /usr/bin/tr p P\n", f);
+  fclose(f);
+
+  int out[2];
+  if (pipe2(out, O_CLOEXEC) != 0)
+    return 0;
+  pid_t pid = start_shell(sh, path, -1, out[1]);
+  close(out[1]);
+  char buf[64] = {0};
+  size_t got = 0;
+  ssize_t k;
+  while (got < sizeof(buf) - 1 && (k = read(out[0], buf + got, sizeof(buf) - 1 - got)) > 0)
+    got += (size_t)k;
+  close(out[0]);
+  waitpid(pid, NULL, 0);
+  return strcmp(buf, "Probe\n") == 0;
+}
+
+static void json_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s; s++)
+  {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', f);
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+static void write_json(const char *file, const char *label, const Shell *shells, int n_shells)
+{
+  FILE *f = fopen(file, "w");
+  if (!f)
+  {
+    perror(file);
+    exit(EXIT_FAILURE);
+  }
+  fputs("{\n  \"label\": ", f);
+  json_string(f, label);
+  fprintf(f, ",\n  \"timestamp\": %ld,\n  \"scale\": %g,\n  \"shells\": {", (long)time(NULL), scale);
+  for (int i = 0; i < n_shells; i++)
+  {
+    fprintf(f, "%s\n    ", i ? "," : "");
+    json_string(f, shells[i].name);
+    fputs(": ", f);
+    json_string(f, shells[i].path);
+  }
+  fputs("\n  },\n  \"results\": [", f);
+  for (int i = 0; i < n_results; i++)
+  {
+    const Result *r = &results[i];
+    fprintf(f, "%s\n    {\"shell\": ", i ? "," : "");
+    json_string(f, r->shell);
+    fputs(", \"workload\": ", f);
+    json_string(f, r->workload);
+    if (r->skipped)
+    {
+      fputs(", \"skipped\": true}", f);
+      continue;
+    }
+    fprintf(f, ", \"lines\": %ld, \"wall_s\": %.6f, \"lines_per_s\": %.1f, \"usec_per_line\": %.3f",
+            r->lines, r->wall_s, r->lines / r->wall_s, r->wall_s * 1e6 / r->lines);
+    fprintf(f, ", \"user_s\": %.6f, \"sys_s\": %.6f, \"maxrss_kb\": %ld, \"exit_status\": %d",
+            r->user_s, r->sys_s, r->maxrss_kb, r->exit_status);
+    if (r->bytes_per_s > 0)
+      fprintf(f, ", \"bytes_per_s\": %.0f", r->bytes_per_s);
+    if (!strcmp(r->workload, "latency"))
+      fprintf(f, ", \"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f", r->p50_us, r->p99_us, r->max_us);
+    fputc('}', f);
+  }
+  fputs("\n  ]\n}\n", f);
+  fclose(f);
+}
+
+static void print_table(void)
+{
+  printf("%-8s %-9s %10s %10s %12s %10s %10s %10s %12s\n", "shell", "workload", "lines", "wall_s",
+         "lines/s", "p50_us", "p99_us", "rss_kb", "MB/s");
+  for (int i = 0; i < n_results; i++)
+  {
+    const Result *r = &results[i];
+    if (r->skipped)
+    {
+      printf("%-8s %-9s %10s\n", r->shell, r->workload, "skipped");
+      continue;
+    }
+    int lat = !strcmp(r->workload, "latency");
+    printf("%-8s %-9s %10ld %10.3f %12.0f ", r->shell, r->workload, r->lines, r->wall_s, r->lines / r->wall_s);
+    if (lat)
+      printf("%10.1f %10.1f ", r->p50_us, r->p99_us);
+    else
+      printf("%10s %10s ", "-", "-");
+    printf("%10ld ", r->maxrss_kb);
+    if (r->bytes_per_s > 0)
+      printf("%12.1f", r->bytes_per_s / (1024 * 1024));
+    else
+      printf("%12s", "-");
+    printf("%s\n", r->exit_status ? "  (non-zero exit)" : "");
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *out_file = "bench-results.json";
+  const char *label = "local";
+  const char *only = "trivial,alias,builtin,pipeline,latency";
+  Shell shells[MAX_SHELLS];
+  int n_shells = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      scale = strtod(argv[++i], NULL);
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+      out_file = argv[++i];
+    else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+      label = argv[++i];
+    else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+      only = argv[++i];
+    else if (strchr(argv[i], '=') && n_shells < MAX_SHELLS)
+    {
+      Shell *sh = &shells[n_shells++];
+      char *eq = strchr(argv[i], '=');
+      *eq = '\0';
+      sh->name = argv[i];
+      sh->path = eq + 1;
+      const char *base = strrchr(sh->path, '/');
+      base = base ? base + 1 : sh->path;
+      sh->posix = strncmp(base, "wsh", 3) != 0;
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-s scale] [-o results.json] [-l label] [-w workloads] name=path ...\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (n_shells == 0 || scale <= 0)
+  {
+    fprintf(stderr, "%s: need at least one name=path shell and a positive scale\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (!mkdtemp(workdir))
+  {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+
+  static const char *workloads[] = {"trivial", "alias", "builtin", "pipeline", "latency"};
+  for (int s = 0; s < n_shells; s++)
+  {
+    shells[s].pipes = probe_pipes(&shells[s]);
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+      if (!strstr(only, workloads[w]))
+        continue;
+      fprintf(stderr, "%s: %s...\n", shells[s].name, workloads[w]);
+      if (!strcmp(workloads[w], "latency"))
+        run_latency(&shells[s]);
+      else
+        run_script(&shells[s], workloads[w]);
+    }
+  }
+
+  print_table();
+  write_json(out_file, label, shells, n_shells);
+  printf("results written to %s\n", out_file);
+
+  // Scripts and data can be large: do not leave them behind
+  char cmd[600];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", workdir);
+  if (system(cmd) != 0)
+    fprintf(stderr, "could not remove %s\n", workdir);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+/*
+ * Launch latency benchmark: fork()+execv versus launch_spawn() while the
+ * process holds an increasing amount of resident memory.
+ *
+ * Usage: spawn_bench [-n iterations] [rss_mb ...]   (default: 10 100 1024)
+ */
+#include "launch.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHILD_PATH "/bin/true"
+
+extern char **environ;
+
+static char *ballast[64]; /* keeps the touched memory reachable */
+static size_t n_ballast = 0;
+
+static double now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Current resident set size in MB, from /proc/self/statm */
+static size_t rss_mb(void)
+{
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+    resident = 0;
+  fclose(f);
+  return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+/* Touch enough fresh memory to bring the RSS up to target_mb */
+static void grow_rss(size_t target_mb)
+{
+  size_t have = rss_mb();
+  if (have >= target_mb)
+    return;
+  size_t len = (target_mb - have) * 1024 * 1024;
+  char *chunk = malloc(len);
+  if (!chunk || n_ballast == sizeof(ballast) / sizeof(ballast[0]))
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memset(chunk, 0xa5, len);
+  ballast[n_ballast++] = chunk;
+}
+
+static double time_fork(int iters)
+{
+  char *argv[] = {CHILD_PATH, NULL};
+  double start = now_us();
+  for (int i = 0; i < iters; i++)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      execv(CHILD_PATH, argv);
+      _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return (now_us() - start) / iters;
+}
+
+static double time_spawn(int iters)
+{
+  char *argv[] = {CHILD_PATH, NULL};
+  LaunchIO io = LAUNCH_IO_INHERIT;
+  double start = now_us();
+  for (int i = 0; i < iters; i++)
+  {
+    pid_t pid = launch_spawn(CHILD_PATH, argv, environ, &io);
+    if (pid < 0)
+    {
+      perror("posix_spawn");
+      exit(EXIT_FAILURE);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return (now_us() - start) / iters;
+}
+
+int main(int argc, char **argv)
+{
+  int iters = 200;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-n") == 0)
+  {
+    char *end;
+    long n = strtol(argv[2], &end, 10);
+    if (*end != '\0' || n < 1 || n > INT_MAX)
+    {
+      fprintf(stderr, "Usage: %s [-n iterations] [rss_mb ...]   (iterations >= 1)\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+    iters = (int)n;
+    first = 3;
+  }
+  static const size_t default_sizes[] = {10, 100, 1024};
+  size_t nsizes = argc > first ? (size_t)(argc - first) : 3;
+
+  printf("%10s %14s %14s %8s\n", "rss_mb", "fork_us", "spawn_us", "ratio");
+  for (size_t i = 0; i < nsizes; i++)
+  {
+    size_t target = argc > first ? strtoul(argv[first + i], NULL, 10) : default_sizes[i];
+    grow_rss(target);
+    double f = time_fork(iters);
+    double s = time_spawn(iters);
+    printf("%10zu %14.1f %14.1f %7.1fx\n", rss_mb(), f, s, f / s);
+  }
+  return EXIT_SUCCESS;
+}
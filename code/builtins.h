@@ -0,0 +1,36 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+// Builtin flags
+#define BI_STATE 0x1     // changes shell state (or exits): runs in the shell
+#define BI_PIPE_NOOP 0x2 // does nothing when used inside a pipeline
+#define BI_NOARGS_QUERY 0x4 // without arguments it only prints (no state change)
+#define BI_LAST_STATUS 0x8 // reads the previous line's status: a barrier in wsh -j
+
+typedef int (*builtin_fn)(int argc, char **argv);
+
+// Entry of the builtin table
+typedef struct {
+    const char *name;
+    builtin_fn handler;
+    unsigned int flags;
+} Builtin;
+
+// Handlers, one per line of builtins.def
+#define BUILTIN(name, handler, flags) int handler(int argc, char **argv);
+#include "builtins.def"
+#undef BUILTIN
+
+// Hash shared by the table generator and the lookup
+static inline unsigned int builtin_name_hash(const char *name, unsigned int seed)
+{
+  unsigned int h = seed;
+  while (*name)
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  return h ^ (h >> 15);
+}
+
+// Find a builtin by name (NULL if name is not a builtin)
+const Builtin *builtin_lookup(const char *name);
+
+#endif // BUILTINS_H
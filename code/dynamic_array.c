@@ -18,7 +18,7 @@ void da_put(DynamicArray *da, const char *val)
 {
   if (da->size == da->capacity)
   { // Resize
-    da->capacity *= 2;
+    da->capacity = da->capacity ? da->capacity * 2 : 4;
     da->data = realloc(da->data, sizeof(char *) * da->capacity);
   }
   da->data[da->size] = strdup(val);
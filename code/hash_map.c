@@ -2,23 +2,166 @@
 #include <string.h>
 #include <stdio.h>
 #include "hash_map.h"
+#include "intern.h"
+
+#define HM_MAX_LOAD_NUM 7 // grow once size exceeds 7/8 of capacity
+#define HM_MAX_LOAD_DEN 8
 
 /**
- * @Brief djb2 hash function by Dan Bernstein
- * @Ref https://theartincode.stanis.me/008-djb2/
+ * @Brief murmur3 finalizer: spreads the bits of an FNV-1a state
+ */
+static unsigned int hash_finish(unsigned int h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h ? h : 1;
+}
+
+/**
+ * @Brief FNV-1a hash followed by a murmur3 finalizer
+ *
+ * The finalizer spreads the bits so that masking with (capacity - 1) is
+ * as good as taking a prime modulus. 0 is reserved for empty slots.
  *
  * @param key The string to hash
- * @return The hash value
+ * @return The hash value (never 0)
+ */
+unsigned int hm_hash(const char *key)
+{
+  unsigned int h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)key; *p; p++)
+  {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return hash_finish(h);
+}
+
+/**
+ * @Brief hm_hash of the first len bytes of key (need not be NUL terminated)
+ */
+unsigned int hm_hash_n(const char *key, size_t len)
+{
+  unsigned int h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)key; len--; p++)
+  {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return hash_finish(h);
+}
+
+/**
+ * @Brief Distance of the entry at idx from its home slot
+ */
+static size_t probe_dist(const HashMap *hm, size_t idx, unsigned int h)
+{
+  return (idx - (h & (hm->capacity - 1))) & (hm->capacity - 1);
+}
+
+/**
+ * @Brief Allocate a zeroed slot array
+ */
+static HashSlot *slots_new(size_t capacity)
+{
+  HashSlot *slots = calloc(capacity, sizeof(HashSlot));
+  if (!slots)
+  {
+    perror("calloc");
+    exit(-1);
+  }
+  return slots;
+}
+
+/**
+ * @Brief Release the key block and (owned) value of a slot
+ */
+static void slot_release(const HashMap *hm, HashSlot *s)
+{
+  if (!s->inline_value && hm->free_value)
+    hm->free_value(s->value);
+  if (!hm->interned)
+    free(s->key);
+}
+
+/**
+ * @Brief Hash of a key: precomputed for an interned handle
+ */
+static unsigned int key_hash(const HashMap *hm, const char *key)
+{
+  return hm->interned ? intern_hash(key) : hm_hash(key);
+}
+
+/**
+ * @Brief Locate the slot holding key (NULL if absent)
+ *
+ * Robin Hood ordering lets the probe stop as soon as it meets an entry
+ * that is closer to its home slot than the key would be.
+ */
+static HashSlot *find_slot(const HashMap *hm, const char *key, unsigned int h)
+{
+  size_t mask = hm->capacity - 1;
+  size_t idx = h & mask;
+  for (size_t dist = 0;; dist++, idx = (idx + 1) & mask)
+  {
+    HashSlot *s = &hm->slots[idx];
+    if (s->hash == 0 || probe_dist(hm, idx, s->hash) < dist)
+      return NULL;
+    if (s->hash == h && (hm->interned ? s->key == key : strcmp(s->key, key) == 0))
+      return s;
+  }
+}
+
+/**
+ * @Brief Place an entry known not to be in the table
+ */
+static void insert_slot(HashMap *hm, HashSlot entry)
+{
+  size_t mask = hm->capacity - 1;
+  size_t idx = entry.hash & mask;
+  size_t dist = 0;
+  while (1)
+  {
+    HashSlot *s = &hm->slots[idx];
+    if (s->hash == 0)
+    {
+      *s = entry;
+      hm->size++;
+      return;
+    }
+    // Rich entries (short probe distance) give their slot to poor ones
+    size_t sd = probe_dist(hm, idx, s->hash);
+    if (sd < dist)
+    {
+      HashSlot tmp = *s;
+      *s = entry;
+      entry = tmp;
+      dist = sd;
+    }
+    idx = (idx + 1) & mask;
+    dist++;
+  }
+}
+
+/**
+ * @Brief Double the capacity and re-place every entry
  */
-unsigned int hash(const char *key)
+static void grow(HashMap *hm)
 {
-  unsigned long h = 5381;
-  int c;
-  while ((c = *key++))
+  HashSlot *old = hm->slots;
+  size_t old_cap = hm->capacity;
+  hm->capacity *= 2;
+  hm->slots = slots_new(hm->capacity);
+  hm->size = 0;
+  for (size_t i = 0; i < old_cap; i++)
   {
-    h = ((h << 5) + h) + c; // h * 33 + c
+    if (old[i].hash)
+      insert_slot(hm, old[i]);
   }
-  return h % TABLE_SIZE;
+  free(old);
 }
 
 /**
@@ -27,6 +170,17 @@ unsigned int hash(const char *key)
  * @return Pointer to a newly created HashMap
  */
 HashMap *hm_create(void)
+{
+  return hm_create_with(NULL);
+}
+
+/**
+ * @Brief Create a HashMap that owns the values stored with hm_put_ptr
+ *
+ * @param free_value Called on a value when it is replaced or removed
+ * @return Pointer to a newly created HashMap
+ */
+HashMap *hm_create_with(hm_free_fn free_value)
 {
   HashMap *ht = malloc(sizeof(HashMap));
   if (!ht)
@@ -34,44 +188,100 @@ HashMap *hm_create(void)
     perror("malloc");
     exit(-1);
   };
-  for (int i = 0; i < TABLE_SIZE; i++)
+  ht->capacity = HM_INIT_CAPACITY;
+  ht->slots = slots_new(ht->capacity);
+  ht->size = 0;
+  ht->free_value = free_value;
+  ht->interned = 0;
+  return ht;
+}
+
+/**
+ * @Brief Create a HashMap keyed by intern() handles
+ *
+ * Keys are neither copied nor freed, their hash is the one computed when
+ * they were interned, and they compare by address. Values are stored with
+ * hm_put_ptr and are not owned by the map.
+ *
+ * @return Pointer to a newly created HashMap
+ */
+HashMap *hm_create_interned(void)
+{
+  return hm_create_interned_with(NULL);
+}
+
+/**
+ * @Brief Create a HashMap keyed by intern() handles that owns its values
+ *
+ * @param free_value Called on a value when it is replaced or removed
+ * @return Pointer to a newly created HashMap
+ */
+HashMap *hm_create_interned_with(hm_free_fn free_value)
+{
+  HashMap *ht = hm_create_with(free_value);
+  ht->interned = 1;
+  return ht;
+}
+
+/**
+ * @Brief Store an entry, replacing any previous one with the same key
+ */
+static void put_entry(HashMap *hm, const char *key, HashSlot entry)
+{
+  HashSlot *s = find_slot(hm, key, entry.hash);
+  if (s)
   {
-    ht->buckets[i] = NULL;
+    slot_release(hm, s);
+    *s = entry;
+    return;
   }
-  return ht;
+  if ((hm->size + 1) * HM_MAX_LOAD_DEN > hm->capacity * HM_MAX_LOAD_NUM)
+    grow(hm);
+  insert_slot(hm, entry);
 }
 
 /**
  * @Brief Insert or update key-value pair
  *
+ * Key and value are copied into a single allocation.
+ *
  * @param hm Pointer to the HashMap
  * @param key The key string
  * @param value The value string
  */
 void hm_put(HashMap *hm, const char *key, const char *value)
 {
-  unsigned int idx = hash(key);
-  Entry *e = hm->buckets[idx];
-  
-  // Check if key already exists
-  while (e)
+  size_t klen = strlen(key);
+  size_t vlen = strlen(value);
+  char *block = malloc(klen + vlen + 2);
+  if (!block)
   {
-    if (strcmp(e->key, key) == 0)
-    {
-      // Update value
-      free(e->value);
-      e->value = strdup(value);
-      return;
-    }
-    e = e->next;
+    perror("malloc");
+    exit(-1);
   }
+  memcpy(block, key, klen + 1);
+  memcpy(block + klen + 1, value, vlen + 1);
+  HashSlot entry = {hm_hash(key), 1, block, block + klen + 1};
+  put_entry(hm, key, entry);
+}
 
-  // Insert new entry at head of list
-  Entry *new_entry = malloc(sizeof(Entry));
-  new_entry->key = strdup(key);
-  new_entry->value = strdup(value);
-  new_entry->next = hm->buckets[idx];
-  hm->buckets[idx] = new_entry;
+/**
+ * @Brief Insert or update key with an arbitrary value
+ *
+ * @param hm Pointer to the HashMap
+ * @param key The key string (copied)
+ * @param value The value; the map releases it with its free_value callback
+ */
+void hm_put_ptr(HashMap *hm, const char *key, void *value)
+{
+  char *k = hm->interned ? (char *)key : strdup(key);
+  if (!k)
+  {
+    perror("strdup");
+    exit(-1);
+  }
+  HashSlot entry = {key_hash(hm, key), 0, k, value};
+  put_entry(hm, key, entry);
 }
 
 /**
@@ -82,123 +292,129 @@ void hm_put(HashMap *hm, const char *key, const char *value)
  */
 char *hm_get(const HashMap *hm, const char *key)
 {
-  const unsigned int idx = hash(key);
-  const Entry *e = hm->buckets[idx];
-  while (e)
-  {
-    if (strcmp(e->key, key) == 0)
-    {
-      return e->value;
-    }
-    e = e->next;
-  }
-  return NULL;
+  return hm_get_ptr(hm, key);
+}
+
+/**
+ * @Brief Get an arbitrary value by key (NULL if not found)
+ */
+void *hm_get_ptr(const HashMap *hm, const char *key)
+{
+  const HashSlot *s = find_slot(hm, key, key_hash(hm, key));
+  return s ? s->value : NULL;
 }
 
 /* Delete the entry with a given key from the hashmap */
 void hm_delete(HashMap *hm, const char *key)
 {
-  const unsigned int idx = hash(key);
-  Entry *e = hm->buckets[idx];
-  Entry *prev = NULL;
+  HashSlot *s = find_slot(hm, key, key_hash(hm, key));
+  if (!s)
+    return;
+  slot_release(hm, s);
 
-  while (e)
+  // Backward-shift the following cluster instead of leaving a tombstone
+  size_t mask = hm->capacity - 1;
+  size_t idx = (size_t)(s - hm->slots);
+  while (1)
   {
-    if (strcmp(e->key, key) == 0)
+    size_t next = (idx + 1) & mask;
+    HashSlot *ns = &hm->slots[next];
+    if (ns->hash == 0 || probe_dist(hm, next, ns->hash) == 0)
+      break;
+    hm->slots[idx] = *ns;
+    idx = next;
+  }
+  memset(&hm->slots[idx], 0, sizeof(HashSlot));
+  hm->size--;
+}
+
+/* Number of entries in the hashmap */
+size_t hm_size(const HashMap *hm)
+{
+  return hm->size;
+}
+
+/* Start iterating over the hashmap */
+void hm_iter_init(HashMapIter *it, const HashMap *hm)
+{
+  it->hm = hm;
+  it->next = 0;
+}
+
+/* Fetch the next entry, returns 0 when there are no more */
+int hm_iter_next(HashMapIter *it, const char **key, void **value)
+{
+  while (it->next < it->hm->capacity)
+  {
+    const HashSlot *s = &it->hm->slots[it->next++];
+    if (s->hash)
     {
-      if (prev)
-      {
-        prev->next = e->next;
-      }
-      else
-      {
-        hm->buckets[idx] = e->next;
-      }
-      free(e->key);
-      free(e->value);
-      free(e);
-      return;
+      if (key)
+        *key = s->key;
+      if (value)
+        *value = s->value;
+      return 1;
     }
-    prev = e;
-    e = e->next;
   }
+  return 0;
 }
 
 /* Print the entries in the hashmap, one in each line */
 void hm_print(const HashMap *hm)
 {
-  for (int i = 0; i < TABLE_SIZE; i++)
+  HashMapIter it;
+  const char *key;
+  void *value;
+  hm_iter_init(&it, hm);
+  while (hm_iter_next(&it, &key, &value))
   {
-    const Entry *e = hm->buckets[i];
-    while (e)
-    {
-      printf("%s = '%s'\n",e->key, e->value);
-      e = e->next;
-    }
+    printf("%s = '%s'\n", key, (char *)value);
   }
 }
 
 /* Print the entries in the hashmap sorted by key */
-int cmp_keys(const void *a, const void *b) {
-  const char *ka = *(const char **)a;
-  const char *kb = *(const char **)b;
-  return strcmp(ka, kb);
+static int cmp_slot_keys(const void *a, const void *b) {
+  const HashSlot *sa = *(const HashSlot *const *)a;
+  const HashSlot *sb = *(const HashSlot *const *)b;
+  return strcmp(sa->key, sb->key);
 }
 
 void hm_print_sorted(const HashMap *hm)
 {
-  // Count total entries
-  int count = 0;
-  for (int i = 0; i < TABLE_SIZE; i++) {
-    Entry *e = hm->buckets[i];
-    while (e) {
-      count++;
-      e = e->next;
-    }
+  if (hm->size == 0) return;
+  // Collect occupied slots
+  const HashSlot **entries = malloc(hm->size * sizeof(HashSlot *));
+  size_t count = 0;
+  for (size_t i = 0; i < hm->capacity; i++) {
+    if (hm->slots[i].hash)
+      entries[count++] = &hm->slots[i];
   }
-  if (count == 0) return;
-  // Collect keys
-  char **keys = malloc(count * sizeof(char *));
-  int idx = 0;
-  for (int i = 0; i < TABLE_SIZE; i++) {
-    Entry *e = hm->buckets[i];
-    while (e) {
-      keys[idx++] = e->key;
-      e = e->next;
-    }
-  }
-  // Sort keys
-  qsort(keys, count, sizeof(char *), cmp_keys);
+  // Sort by key
+  qsort(entries, count, sizeof(HashSlot *), cmp_slot_keys);
   // Print key-value pairs
-  for (int i = 0; i < count; i++) {
-    char *val = hm_get(hm, keys[i]);
-    printf("%s = '%s'\n", keys[i], val);
+  for (size_t i = 0; i < count; i++) {
+    printf("%s = '%s'\n", entries[i]->key, (char *)entries[i]->value);
   }
-  free(keys);
+  free(entries);
 }
 
-/* Reinitialize the hashmap */
+/* Remove every entry, leaving an empty hashmap that can be reused */
 void hm_reset(HashMap *hm)
 {
-  hm_free(hm);
-  hm = hm_create();
+  for (size_t i = 0; i < hm->capacity; i++)
+  {
+    if (hm->slots[i].hash)
+      slot_release(hm, &hm->slots[i]);
+  }
+  memset(hm->slots, 0, hm->capacity * sizeof(HashSlot));
+  hm->size = 0;
 }
 
 /* Free the memory used by the hashmap */
 void hm_free(HashMap *hm)
 {
-  for (int i = 0; i < TABLE_SIZE; i++)
-  {
-    Entry *e = hm->buckets[i];
-    while (e)
-    {
-      Entry *next = e->next;
-      free(e->key);
-      free(e->value);
-      free(e);
-      e = next;
-    }
-  }
+  hm_reset(hm);
+  free(hm->slots);
   free(hm);
 }
 
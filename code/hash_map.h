@@ -1,39 +1,85 @@
 #ifndef HASH_MAP_H
 #define HASH_MAP_H
 
-#define TABLE_SIZE 101  // prime number for better hashing
+#include <stddef.h>
 
-// Entry in the key-value store
-typedef struct Entry{
+#define HM_INIT_CAPACITY 16 // power of two
+
+// Called on values a map owns when they are replaced or removed
+typedef void (*hm_free_fn)(void *value);
+
+// Slot in the open-addressing table. hash == 0 marks an empty slot.
+typedef struct {
+    unsigned int hash;          // cached full hash (fingerprint)
+    unsigned int inline_value;  // value lives in the same block as key
     char *key;
-    char *value;
-    struct Entry *next;  // for chaining
-} Entry;
+    void *value;
+} HashSlot;
 
-// Hash table
+// Resizable Robin Hood hash table keyed by strings
 typedef struct {
-    Entry *buckets[TABLE_SIZE];
+    HashSlot *slots;
+    size_t capacity;
+    size_t size;
+    hm_free_fn free_value;  // for hm_put_ptr values (NULL: not owned)
+    int interned;           // keys are intern() handles (see hm_create_interned)
 } HashMap;
 
+// Iterator over the entries of a HashMap (unspecified order)
+typedef struct {
+    const HashMap *hm;
+    size_t next;
+} HashMapIter;
+
+// Hash used by the table (never 0), of a string or of its first len bytes
+unsigned int hm_hash(const char *key);
+unsigned int hm_hash_n(const char *key, size_t len);
+
 // Create a new HashMap
 HashMap *hm_create(void);
 
-// Insert or update key-value pair
+// Create a HashMap whose hm_put_ptr values are released with free_value
+HashMap *hm_create_with(hm_free_fn free_value);
+
+// Create a HashMap keyed by intern() handles: keys are not copied and
+// compare by address, values go in with hm_put_ptr (not owned). Every
+// key passed to it, lookups included, must be a handle.
+HashMap *hm_create_interned(void);
+
+// Same, but the hm_put_ptr values are released with free_value
+HashMap *hm_create_interned_with(hm_free_fn free_value);
+
+// Insert or update key-value pair (the value string is copied)
 void hm_put(HashMap *hm, const char *key, const char *value);
 
+// Insert or update key with an arbitrary value (ownership passes to the map)
+void hm_put_ptr(HashMap *hm, const char *key, void *value);
+
 // Get value by key (NULL if not found)
 char *hm_get(const HashMap *hm, const char *key);
 
+// Get an arbitrary value by key (NULL if not found)
+void *hm_get_ptr(const HashMap *hm, const char *key);
+
 // Delete Entry with given Key
 void hm_delete(HashMap *hm, const char *key);
 
+// Number of entries
+size_t hm_size(const HashMap *hm);
+
+// Start iterating; hm must not be modified until iteration is done
+void hm_iter_init(HashMapIter *it, const HashMap *hm);
+
+// Fetch the next entry. Returns 0 once every entry has been visited.
+int hm_iter_next(HashMapIter *it, const char **key, void **value);
+
 // Print the Key Value pairs in the HashMap
 void hm_print(const HashMap *hm);
 
 // Print the Key Value pairs in sorted order by Key
 void hm_print_sorted(const HashMap *hm);
 
-// Reset HashMap
+// Remove all entries (the HashMap itself stays usable)
 void hm_reset(HashMap *hm);
 
 // Free whole HashMap
@@ -0,0 +1,351 @@
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIST_MIN_BYTES 4096
+#define HIST_GRAM 3 // bytes per index key
+
+/**
+ * @Brief Entry at ring position i (0 = oldest)
+ */
+static HistEntry *entry_at(const History *h, size_t i)
+{
+  size_t k = h->head + i;
+  if (k >= h->entries_cap)
+    k -= h->entries_cap;
+  return &h->entries[k];
+}
+
+/**
+ * @Brief Free a posting list (HashMap value destructor)
+ */
+static void postings_free(void *value)
+{
+  HistPostings *p = value;
+  free(p->seqs);
+  free(p);
+}
+
+/**
+ * @Brief Add every trigram of a line to the index
+ *
+ * A line is added with its sequence number, which only grows, so each
+ * posting list stays sorted and a repeated trigram is a check of its tail.
+ */
+static void index_line(History *h, size_t seq, const char *line, size_t len)
+{
+  char key[HIST_GRAM + 1];
+  key[HIST_GRAM] = '\0';
+  for (size_t i = 0; i + HIST_GRAM <= len; i++)
+  {
+    memcpy(key, line + i, HIST_GRAM);
+    if (strlen(key) != HIST_GRAM)
+      continue; // embedded NUL
+    HistPostings *p = hm_get_ptr(h->trigrams, key);
+    if (!p)
+    {
+      p = calloc(1, sizeof(HistPostings));
+      if (!p)
+      {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+      }
+      hm_put_ptr(h->trigrams, key, p);
+    }
+    if (p->len && p->seqs[p->len - 1] == seq)
+      continue;
+    if (p->len == p->cap)
+    {
+      size_t cap = p->cap ? p->cap * 2 : 4;
+      size_t *seqs = realloc(p->seqs, sizeof(size_t) * cap);
+      if (!seqs)
+      {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+      p->seqs = seqs;
+      p->cap = cap;
+    }
+    p->seqs[p->len++] = seq;
+  }
+}
+
+/**
+ * @Brief (Re)build the trigram index from the entries kept
+ *
+ * Evicted lines are not removed from posting lists one by one (searches
+ * skip them); instead the index is rebuilt once max_entries lines have
+ * been evicted, which keeps it at most about twice its live size.
+ */
+static void index_rebuild(History *h)
+{
+  if (!h->trigrams)
+    h->trigrams = hm_create_with(postings_free);
+  else
+    hm_reset(h->trigrams);
+  size_t oldest_seq = h->next_seq - h->count;
+  for (size_t i = 0; i < h->count; i++)
+  {
+    HistEntry *e = entry_at(h, i);
+    index_line(h, oldest_seq + i, h->bytes + e->off, e->len);
+  }
+  h->evicted = 0;
+}
+
+/**
+ * @Brief Forget the oldest entry; its bytes become free space
+ */
+static void evict_oldest(History *h)
+{
+  h->head = h->head + 1 == h->entries_cap ? 0 : h->head + 1;
+  h->count--;
+  h->evicted++;
+}
+
+/**
+ * @Brief Find room for need contiguous bytes in the store
+ *
+ * Lines are written in order around the store. A line that does not fit
+ * before the end of the store starts again at offset 0, leaving the tail
+ * unused until the entries in front of it are evicted.
+ *
+ * @return Offset of the free room, or (size_t)-1 if there is none
+ */
+static size_t find_room(const History *h, size_t need)
+{
+  if (h->count == 0)
+    return need <= h->bytes_cap ? 0 : (size_t)-1;
+
+  size_t oldest = entry_at(h, 0)->off;
+  if (h->wpos > oldest)
+  { // live bytes are [oldest, wpos)
+    if (h->bytes_cap - h->wpos >= need)
+      return h->wpos;
+    if (oldest >= need)
+      return 0;
+    return (size_t)-1;
+  }
+  // wrapped: live bytes are [oldest, end) and [0, wpos)
+  return oldest - h->wpos >= need ? h->wpos : (size_t)-1;
+}
+
+/**
+ * @Brief Grow the byte store so that need more bytes fit, compacting it
+ */
+static void grow_bytes(History *h, size_t need)
+{
+  size_t live = 0;
+  for (size_t i = 0; i < h->count; i++)
+    live += entry_at(h, i)->len + 1;
+
+  size_t cap = h->bytes_cap ? h->bytes_cap : HIST_MIN_BYTES;
+  while (cap < live + need)
+    cap *= 2;
+
+  char *bytes = malloc(cap);
+  if (!bytes)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  size_t pos = 0;
+  for (size_t i = 0; i < h->count; i++)
+  {
+    HistEntry *e = entry_at(h, i);
+    memcpy(bytes + pos, h->bytes + e->off, e->len + 1);
+    e->off = pos;
+    pos += e->len + 1;
+  }
+  free(h->bytes);
+  h->bytes = bytes;
+  h->bytes_cap = cap;
+  h->wpos = pos;
+}
+
+/**
+ * @Brief Drop all entries and change the maximum number kept
+ *
+ * @param h The history
+ * @param max_entries Entries to keep (0 turns history off)
+ */
+void hist_set_size(History *h, size_t max_entries)
+{
+  hist_free(h);
+  h->max_entries = max_entries;
+}
+
+/**
+ * @Brief Append a line to the history
+ *
+ * O(1) amortized: once the store has grown to fit max_entries lines of
+ * the usual length, a line costs one memcpy and evicts at most a few old
+ * entries.
+ *
+ * @param h The history
+ * @param line The line (need not be NUL terminated)
+ * @param len Length of the line in bytes
+ */
+void hist_add(History *h, const char *line, size_t len)
+{
+  if (h->max_entries == 0)
+    return;
+
+  if (h->count == h->entries_cap && h->entries_cap < h->max_entries)
+  { // Not full yet, so head is still 0 and a plain realloc keeps the order
+    size_t cap = h->entries_cap ? h->entries_cap * 2 : 16;
+    if (cap > h->max_entries)
+      cap = h->max_entries;
+    HistEntry *entries = realloc(h->entries, sizeof(HistEntry) * cap);
+    if (!entries)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    h->entries = entries;
+    h->entries_cap = cap;
+  }
+  if (h->count == h->max_entries)
+    evict_oldest(h);
+
+  size_t need = len + 1;
+  size_t off = find_room(h, need);
+  if (off == (size_t)-1)
+  {
+    grow_bytes(h, need);
+    off = h->wpos;
+  }
+  memcpy(h->bytes + off, line, len);
+  h->bytes[off + len] = '\0';
+  h->wpos = off + need;
+
+  HistEntry *e = &h->entries[(h->head + h->count) % h->entries_cap];
+  e->off = off;
+  e->len = len;
+  h->count++;
+  size_t seq = h->next_seq++;
+
+  if (h->trigrams)
+  {
+    if (h->evicted >= h->max_entries)
+      index_rebuild(h);
+    else
+      index_line(h, seq, line, len);
+  }
+}
+
+/**
+ * @Brief Number of entries currently kept
+ */
+size_t hist_count(const History *h)
+{
+  return h->count;
+}
+
+/**
+ * @Brief Get an entry, oldest first
+ *
+ * @return The NUL terminated line, valid until the next hist_add
+ */
+const char *hist_get(const History *h, size_t i)
+{
+  if (i >= h->count)
+    return NULL;
+  return h->bytes + entry_at(h, i)->off;
+}
+
+/**
+ * @Brief Build the search index up front
+ *
+ * For interactive use, where paying for the first search while the user
+ * waits is worse than a few extra postings per line.
+ */
+void hist_index(History *h)
+{
+  if (!h->trigrams)
+    index_rebuild(h);
+}
+
+/**
+ * @Brief Find the newest entry before `before` that contains needle
+ *
+ * Needles of three or more bytes are looked up in the trigram index: only
+ * the lines in the shortest posting list of the needle's trigrams are
+ * compared, newest first. Shorter needles scan the entries directly.
+ *
+ * @param h The history
+ * @param needle Substring to look for
+ * @param before Only entries with a smaller index are considered
+ * @return The entry's index (as for hist_get) or -1
+ */
+long hist_find(History *h, const char *needle, size_t before)
+{
+  size_t nlen = strlen(needle);
+  if (before > h->count)
+    before = h->count;
+
+  if (nlen < HIST_GRAM)
+  {
+    for (size_t i = before; i-- > 0;)
+    {
+      if (strstr(hist_get(h, i), needle))
+        return (long)i;
+    }
+    return -1;
+  }
+
+  hist_index(h);
+
+  HistPostings *rarest = NULL;
+  char key[HIST_GRAM + 1];
+  key[HIST_GRAM] = '\0';
+  for (size_t i = 0; i + HIST_GRAM <= nlen; i++)
+  {
+    memcpy(key, needle + i, HIST_GRAM);
+    HistPostings *p = hm_get_ptr(h->trigrams, key);
+    if (!p)
+      return -1; // no line has this trigram
+    if (!rarest || p->len < rarest->len)
+      rarest = p;
+  }
+
+  // First posting at or after the search limit, then walk back
+  size_t oldest_seq = h->next_seq - h->count;
+  size_t limit = oldest_seq + before;
+  size_t lo = 0, hi = rarest->len;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (rarest->seqs[mid] < limit)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (size_t k = lo; k-- > 0 && rarest->seqs[k] >= oldest_seq;)
+  {
+    size_t i = rarest->seqs[k] - oldest_seq;
+    if (strstr(hist_get(h, i), needle))
+      return (long)i;
+  }
+  return -1;
+}
+
+/**
+ * @Brief Release all memory (the history stays usable and empty)
+ */
+void hist_free(History *h)
+{
+  free(h->entries);
+  free(h->bytes);
+  if (h->trigrams)
+    hm_free(h->trigrams);
+  h->trigrams = NULL;
+  h->evicted = 0;
+  h->entries = NULL;
+  h->bytes = NULL;
+  h->entries_cap = 0;
+  h->bytes_cap = 0;
+  h->head = 0;
+  h->count = 0;
+  h->wpos = 0;
+}
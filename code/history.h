@@ -0,0 +1,66 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "hash_map.h"
+#include <stddef.h>
+
+#define HIST_DEFAULT_SIZE 1000 // entries kept when HISTSIZE is not set
+
+// Where one line lives in the byte store
+typedef struct {
+    size_t off;
+    size_t len;   // without the NUL terminator
+} HistEntry;
+
+// Sequence numbers of the lines containing one trigram, ascending
+typedef struct {
+    size_t *seqs;
+    size_t len;
+    size_t cap;
+} HistPostings;
+
+// Bounded command history. Entries form a ring of at most max_entries;
+// their bytes live in one circular store, each line contiguous and NUL
+// terminated, so adding and evicting a line never calls malloc/free.
+// A trigram index for substring search is built on the first search and
+// kept up to date from then on.
+typedef struct {
+    HistEntry *entries;
+    size_t max_entries;   // 0: history is off
+    size_t entries_cap;   // grows up to max_entries
+    size_t head;          // ring index of the oldest entry
+    size_t count;
+    char *bytes;
+    size_t bytes_cap;
+    size_t wpos;          // where the next line would be written
+    size_t next_seq;      // sequence number of the next line added
+    HashMap *trigrams;    // trigram -> HistPostings (NULL until searched)
+    size_t evicted;       // evictions since the index was (re)built
+} History;
+
+#define HISTORY_INIT {NULL, HIST_DEFAULT_SIZE, 0, 0, 0, NULL, 0, 0, 0, NULL, 0}
+
+// Drop all entries and keep at most max_entries from now on (0 turns it off)
+void hist_set_size(History *h, size_t max_entries);
+
+// Record len bytes of line, evicting the oldest entry once full
+void hist_add(History *h, const char *line, size_t len);
+
+// Number of entries currently kept
+size_t hist_count(const History *h);
+
+// Entry i, oldest first (NULL if out of range)
+const char *hist_get(const History *h, size_t i);
+
+// Build the search index now and keep it up to date from here on
+// (otherwise it is built by the first hist_find)
+void hist_index(History *h);
+
+// Index of the newest entry before entry `before` that contains needle,
+// or -1 if there is none. Pass hist_count(h) to search everything.
+long hist_find(History *h, const char *needle, size_t before);
+
+// Release all memory
+void hist_free(History *h);
+
+#endif // HISTORY_H
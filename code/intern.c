@@ -0,0 +1,105 @@
+#include "intern.h"
+#include "hash_map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_INIT_CAPACITY 256 // power of two
+
+/**
+ * @Brief Slot where the text is, or the empty slot where it would go
+ */
+static InternStr **find(const InternTable *t, const char *s, size_t len, unsigned int h)
+{
+  size_t mask = t->capacity - 1;
+  for (size_t idx = h & mask;; idx = (idx + 1) & mask)
+  {
+    InternStr *e = t->slots[idx];
+    if (!e || (e->hash == h && e->len == len && memcmp(e->str, s, len) == 0))
+      return &t->slots[idx];
+  }
+}
+
+/**
+ * @Brief Double the table and re-place every string
+ */
+static void grow(InternTable *t)
+{
+  InternStr **old = t->slots;
+  size_t old_cap = t->capacity;
+  t->capacity = old_cap ? old_cap * 2 : INTERN_INIT_CAPACITY;
+  t->slots = calloc(t->capacity, sizeof(InternStr *));
+  if (!t->slots)
+  {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  size_t mask = t->capacity - 1;
+  for (size_t i = 0; i < old_cap; i++)
+  {
+    if (!old[i])
+      continue;
+    size_t idx = old[i]->hash & mask;
+    while (t->slots[idx])
+      idx = (idx + 1) & mask;
+    t->slots[idx] = old[i];
+  }
+  free(old);
+}
+
+/**
+ * @Brief Find a string without adding it
+ */
+const char *intern_find(const InternTable *t, const char *s, size_t len)
+{
+  if (t->size == 0)
+    return NULL;
+  InternStr *e = *find(t, s, len, hm_hash_n(s, len));
+  return e ? e->str : NULL;
+}
+
+/**
+ * @Brief Intern len bytes of s
+ *
+ * The string is hashed once; if it is new, it is copied next to its
+ * header in the table's arena, where it stays until intern_free.
+ *
+ * @return The handle
+ */
+const char *intern(InternTable *t, const char *s, size_t len)
+{
+  if ((t->size + 1) * 4 > t->capacity * 3)
+    grow(t);
+  unsigned int h = hm_hash_n(s, len);
+  InternStr **slot = find(t, s, len, h);
+  if (*slot)
+    return (*slot)->str;
+
+  InternStr *e = arena_alloc(&t->store, sizeof(InternStr) + len + 1);
+  e->hash = h;
+  e->len = (unsigned int)len;
+  memcpy(e->str, s, len);
+  e->str[len] = '\0';
+  *slot = e;
+  t->size++;
+  return e->str;
+}
+
+/**
+ * @Brief Intern a NUL terminated string
+ */
+const char *intern_cstr(InternTable *t, const char *s)
+{
+  return intern(t, s, strlen(s));
+}
+
+/**
+ * @Brief Free the table and every string in it
+ */
+void intern_free(InternTable *t)
+{
+  free(t->slots);
+  arena_free(&t->store);
+  t->slots = NULL;
+  t->capacity = t->size = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "arena.h"
+#include <stddef.h>
+
+// An interned string. The text follows its header, so a handle (the
+// `const char *` returned by intern) reaches its hash and length in O(1).
+typedef struct {
+    unsigned int hash;     // hm_hash of the text (never 0)
+    unsigned int len;
+    char str[];
+} InternStr;
+
+// Table of interned strings: one copy per distinct text. Two handles are
+// equal exactly when their texts are, so they compare with ==. Strings
+// are never removed, and handles stay valid until intern_free.
+typedef struct {
+    InternStr **slots;     // open addressing, NULL for an empty slot
+    size_t capacity;       // power of two
+    size_t size;
+    Arena store;           // the strings (never reset)
+} InternTable;
+
+#define INTERN_TABLE_INIT {NULL, 0, 0, ARENA_INIT(16 * 1024)}
+
+// Handle for the len bytes at s (need not be NUL terminated); the text is
+// copied the first time it is seen
+const char *intern(InternTable *t, const char *s, size_t len);
+
+// intern() for a NUL terminated string
+const char *intern_cstr(InternTable *t, const char *s);
+
+// Handle for s if it was interned before, NULL otherwise (nothing is added)
+const char *intern_find(const InternTable *t, const char *s, size_t len);
+
+// Precomputed hash and length of a handle
+static inline unsigned int intern_hash(const char *handle)
+{
+  return ((const InternStr *)(handle - offsetof(InternStr, str)))->hash;
+}
+
+static inline size_t intern_len(const char *handle)
+{
+  return ((const InternStr *)(handle - offsetof(InternStr, str)))->len;
+}
+
+// Free every string (all handles become invalid)
+void intern_free(InternTable *t);
+
+#endif // INTERN_H
@@ -0,0 +1,233 @@
+#include "jobs.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+static volatile sig_atomic_t child_exited = 0;
+
+static void on_sigchld(int sig)
+{
+  (void)sig;
+  child_exited = 1;
+}
+
+/**
+ * @Brief Install the SIGCHLD handler
+ *
+ * The handler only sets a flag; the shell reaps at safe points (before a
+ * prompt or a command) with jobs_reap. SA_RESTART keeps the foreground
+ * waitpid and reads from being interrupted.
+ */
+void jobs_init(void)
+{
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_sigchld;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  if (sigaction(SIGCHLD, &sa, NULL) != 0)
+    perror("sigaction");
+}
+
+/**
+ * @Brief Add a background job
+ *
+ * @param t The table
+ * @param cmd The line as typed (need not be NUL terminated)
+ * @param len Length of cmd
+ * @param pids Stages that were started
+ * @param npids Number of pids
+ * @return The new job, valid until the table changes
+ */
+Job *jobs_add(JobTable *t, const char *cmd, size_t len, const pid_t *pids, int npids)
+{
+  if (t->n == t->cap)
+  {
+    size_t cap = t->cap ? t->cap * 2 : 8;
+    Job *jobs = realloc(t->jobs, sizeof(Job) * cap);
+    if (!jobs)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    t->jobs = jobs;
+    t->cap = cap;
+  }
+  Job *job = &t->jobs[t->n];
+  job->id = t->n ? t->jobs[t->n - 1].id + 1 : 1;
+  job->pids = malloc(sizeof(pid_t) * (size_t)npids);
+  job->status = calloc((size_t)npids, sizeof(int));
+  job->cmd = strndup(cmd, len);
+  if (!job->pids || !job->status || !job->cmd)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(job->pids, pids, sizeof(pid_t) * (size_t)npids);
+  job->npids = npids;
+  job->nlive = npids;
+  t->n++;
+  return job;
+}
+
+/**
+ * @Brief Reap every exited stage of every job without blocking
+ *
+ * Only the jobs' own pids are waited for, so children the shell is
+ * waiting for elsewhere (pipeline stages, -j jobs) are never taken.
+ *
+ * @return Number of jobs that finished
+ */
+static int reap_now(JobTable *t)
+{
+  int finished = 0;
+  for (size_t j = 0; j < t->n; j++)
+  {
+    Job *job = &t->jobs[j];
+    if (job->nlive == 0)
+      continue;
+    for (int i = 0; i < job->npids; i++)
+    {
+      if (job->pids[i] <= 0)
+        continue;
+      int st;
+      pid_t r = waitpid(job->pids[i], &st, WNOHANG);
+      if (r == 0 || (r < 0 && errno == EINTR))
+        continue;
+      job->status[i] = r < 0 ? 127 << 8 : st; // ECHILD: reaped elsewhere
+      job->pids[i] = -job->pids[i];           // keep the pid for display
+      if (--job->nlive == 0)
+        finished++;
+    }
+  }
+  return finished;
+}
+
+/**
+ * @Brief Reap finished job stages if SIGCHLD arrived since the last call
+ */
+int jobs_reap(JobTable *t)
+{
+  if (!child_exited)
+    return 0;
+  child_exited = 0; // before reaping: a later SIGCHLD sets it again
+  return reap_now(t);
+}
+
+/**
+ * @Brief Wait for a job to finish
+ *
+ * SIGCHLD is blocked while checking, and sigsuspend atomically unblocks
+ * it, so an exit between the check and the sleep cannot be missed.
+ *
+ * @param t The table
+ * @param job Job to wait for, or NULL for whichever finishes first
+ *            (a job that already finished counts)
+ * @return The finished job, or NULL if job is NULL and there are no jobs
+ */
+Job *jobs_wait(JobTable *t, Job *job)
+{
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &block, &old);
+
+  ptrdiff_t index = job ? job - t->jobs : -1;
+  Job *done = NULL;
+  while (1)
+  {
+    child_exited = 0; // this loop reaps whatever the flag was set for
+    reap_now(t);
+    if (index >= 0)
+    {
+      if (t->jobs[index].nlive == 0)
+        done = &t->jobs[index];
+    }
+    else
+    {
+      for (size_t j = 0; j < t->n && !done; j++)
+      {
+        if (t->jobs[j].nlive == 0)
+          done = &t->jobs[j];
+      }
+    }
+    if (done || (index < 0 && t->n == 0))
+      break;
+    sigsuspend(&old);
+  }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  return done;
+}
+
+/**
+ * @Brief Find a job by number
+ */
+Job *jobs_find(JobTable *t, int id)
+{
+  for (size_t j = 0; j < t->n; j++)
+  {
+    if (t->jobs[j].id == id)
+      return &t->jobs[j];
+  }
+  return NULL;
+}
+
+/**
+ * @Brief Find the job one of whose stages is pid
+ */
+Job *jobs_find_pid(JobTable *t, pid_t pid)
+{
+  for (size_t j = 0; j < t->n; j++)
+  {
+    for (int i = 0; i < t->jobs[j].npids; i++)
+    {
+      pid_t p = t->jobs[j].pids[i];
+      if (p == pid || -p == pid)
+        return &t->jobs[j];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @Brief Exit status of a finished job (from its last stage)
+ */
+int jobs_exit_status(const Job *job)
+{
+  int st = job->status[job->npids - 1];
+  if (WIFEXITED(st))
+    return WEXITSTATUS(st);
+  return WIFSIGNALED(st) ? 128 + WTERMSIG(st) : 1;
+}
+
+/**
+ * @Brief Remove a job from the table
+ */
+void jobs_remove(JobTable *t, Job *job)
+{
+  size_t j = (size_t)(job - t->jobs);
+  free(job->pids);
+  free(job->status);
+  free(job->cmd);
+  memmove(&t->jobs[j], &t->jobs[j + 1], sizeof(Job) * (t->n - j - 1));
+  t->n--;
+}
+
+/**
+ * @Brief Free the table
+ */
+void jobs_free(JobTable *t)
+{
+  for (size_t j = 0; j < t->n; j++)
+  {
+    free(t->jobs[j].pids);
+    free(t->jobs[j].status);
+    free(t->jobs[j].cmd);
+  }
+  free(t->jobs);
+  t->jobs = NULL;
+  t->n = t->cap = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// A background pipeline started with `&`
+typedef struct {
+    int id;          // job number, as in %1
+    pid_t *pids;     // one per stage that was started
+    int *status;     // wait status per stage (valid once reaped)
+    int npids;
+    int nlive;       // stages not reaped yet
+    char *cmd;       // the line as typed
+} Job;
+
+// Background jobs of the shell, oldest first
+typedef struct {
+    Job *jobs;
+    size_t n;
+    size_t cap;
+} JobTable;
+
+#define JOB_TABLE_INIT {NULL, 0, 0}
+
+// Install the SIGCHLD handler that tells jobs_reap there is work to do
+void jobs_init(void);
+
+// Add a job for the started pids (copied); cmd need not be NUL terminated
+Job *jobs_add(JobTable *t, const char *cmd, size_t len, const pid_t *pids, int npids);
+
+// Reap the job stages that have exited, without blocking. Does nothing
+// unless SIGCHLD arrived since the last call. Returns the number of jobs
+// that finished.
+int jobs_reap(JobTable *t);
+
+// Block until job has finished (or, with job NULL, any job). Returns the
+// finished job, or NULL if job is NULL and there are no jobs.
+Job *jobs_wait(JobTable *t, Job *job);
+
+// Job by number, or the job one of whose stages is pid (NULL if none)
+Job *jobs_find(JobTable *t, int id);
+Job *jobs_find_pid(JobTable *t, pid_t pid);
+
+// Exit status of a finished job: its last stage's, like a foreground pipeline
+int jobs_exit_status(const Job *job);
+
+// Forget a job (it must have finished)
+void jobs_remove(JobTable *t, Job *job);
+
+// Free the table; running jobs are left alone
+void jobs_free(JobTable *t);
+
+#endif // JOBS_H
@@ -0,0 +1,71 @@
+#define _GNU_SOURCE /* close_range */
+#include "launch.h"
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * @Brief Start an external command with posix_spawn
+ *
+ * glibc implements posix_spawn with clone(CLONE_VM | CLONE_VFORK), so the
+ * cost of starting a child does not grow with the shell's RSS the way
+ * fork() does. The pipe dup2 work is expressed as file actions; any other
+ * descriptor is expected to be O_CLOEXEC and goes away at exec.
+ *
+ * @param path Resolved executable to run
+ * @param argv NULL terminated argument vector
+ * @param envp NULL terminated environment
+ * @param io Descriptors to install in the child
+ * @return The child's pid or -1 (errno set) on failure
+ */
+pid_t launch_spawn(const char *path, char *const argv[], char *const envp[], const LaunchIO *io)
+{
+  posix_spawn_file_actions_t fa;
+  int err = posix_spawn_file_actions_init(&fa);
+  if (err != 0)
+  {
+    errno = err;
+    return -1;
+  }
+
+  if (io->in_fd >= 0 && io->in_fd != STDIN_FILENO)
+    err = err ? err : posix_spawn_file_actions_adddup2(&fa, io->in_fd, STDIN_FILENO);
+  if (io->out_fd >= 0 && io->out_fd != STDOUT_FILENO)
+    err = err ? err : posix_spawn_file_actions_adddup2(&fa, io->out_fd, STDOUT_FILENO);
+
+  pid_t pid = -1;
+  if (err == 0)
+    err = posix_spawn(&pid, path, &fa, NULL, argv, envp);
+  posix_spawn_file_actions_destroy(&fa);
+  if (err != 0)
+  {
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+/**
+ * @Brief fork() a child and apply io in it
+ *
+ * Only used for builtins that have to run in a separate process; external
+ * commands should always go through launch_spawn.
+ *
+ * @param io Descriptors to install in the child
+ * @return Same as fork()
+ */
+pid_t launch_fork(const LaunchIO *io)
+{
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+
+  if (io->in_fd >= 0 && io->in_fd != STDIN_FILENO)
+    dup2(io->in_fd, STDIN_FILENO);
+  if (io->out_fd >= 0 && io->out_fd != STDOUT_FILENO)
+    dup2(io->out_fd, STDOUT_FILENO);
+  // No exec follows, so O_CLOEXEC does not help: drop everything else in one call
+  close_range(STDERR_FILENO + 1, ~0U, 0);
+  return 0;
+}
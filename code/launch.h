@@ -0,0 +1,25 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+
+// Descriptor plumbing applied in a child before it runs its command.
+// Every other descriptor the shell opens is O_CLOEXEC, so nothing else
+// has to be closed explicitly.
+typedef struct {
+    int in_fd;            // dup'd onto stdin (-1 to inherit)
+    int out_fd;           // dup'd onto stdout (-1 to inherit)
+} LaunchIO;
+
+#define LAUNCH_IO_INHERIT {-1, -1}
+
+// Start an executable without copying the shell's address space (posix_spawn),
+// with envp as its environment. Returns the child's pid, or -1 with errno set
+// if it could not be started.
+pid_t launch_spawn(const char *path, char *const argv[], char *const envp[], const LaunchIO *io);
+
+// fork() fallback for builtins that must run in a child. Behaves like fork(),
+// with io already applied and every descriptor above stderr closed in the child.
+pid_t launch_fork(const LaunchIO *io);
+
+#endif // LAUNCH_H
@@ -0,0 +1,224 @@
+#include "lexer.h"
+#include <ctype.h>
+#include <string.h>
+
+/**
+ * @Brief Append an empty segment, growing the segment array if needed
+ *
+ * The segment array is the arena's latest allocation while lexing, so it
+ * normally grows in place.
+ */
+static Segment *push_segment(Arena *arena, CommandLine *cl)
+{
+  if (cl->nsegs == cl->seg_cap)
+  {
+    int cap = cl->seg_cap ? cl->seg_cap * 2 : 4;
+    cl->segs = arena_realloc(arena, cl->segs, sizeof(Segment) * cl->seg_cap, sizeof(Segment) * cap);
+    cl->seg_cap = cap;
+  }
+  Segment *seg = &cl->segs[cl->nsegs++];
+  memset(seg, 0, sizeof(*seg));
+  return seg;
+}
+
+/**
+ * @Brief Length of the shell variable name at the start of s
+ */
+size_t lex_name_len(const char *s)
+{
+  if (!isalpha((unsigned char)*s) && *s != '_')
+    return 0;
+  size_t n = 1;
+  while (isalnum((unsigned char)s[n]) || s[n] == '_')
+    n++;
+  return n;
+}
+
+/**
+ * @Brief Find the `)` that closes a command substitution
+ *
+ * @param open The `(` of `$(`
+ * @param end End of the text
+ * @return The matching `)`, or NULL if it is missing
+ */
+const char *lex_subst_end(const char *open, const char *end)
+{
+  int depth = 0;
+  for (const char *p = open; p < end; p++)
+  {
+    if (*p == '\'')
+    {
+      p = memchr(p + 1, '\'', (size_t)(end - p - 1));
+      if (!p)
+        return NULL;
+    }
+    else if (*p == '(')
+      depth++;
+    else if (*p == ')' && --depth == 0)
+      return p;
+  }
+  return NULL;
+}
+
+/**
+ * @Brief Remember that token ntok has something to expand
+ */
+static void push_expand(Arena *arena, CommandLine *cl, size_t ntok)
+{
+  cl->expand = arena_realloc(arena, cl->expand, sizeof(int) * (size_t)cl->nexpand,
+                             sizeof(int) * (size_t)(cl->nexpand + 1));
+  cl->expand[cl->nexpand++] = (int)ntok;
+}
+
+/**
+ * @Brief Lex a command line into pipeline segments in a single pass
+ *
+ * Words are separated by whitespace, a word starting with a single quote
+ * runs up to the next single quote (spaces and `|` included), and an
+ * unquoted `|` ends the current segment. A trailing `&` sets cl->background
+ * and is dropped. A `$(...)` in an unquoted word is kept verbatim (its
+ * spaces and `|` included); words with a `$(...)`, `$NAME` or `${NAME}`
+ * are listed in cl->expand for the shell to expand. Leading NAME=value
+ * words of a segment go to its assign list. Token bytes are copied once into
+ * cl->store; each segment's argv points at them. The raw, trimmed text of
+ * the line stays available in cl->line for history and alias expansion.
+ * Nothing is taken from the heap: all memory comes from the arena.
+ *
+ * @param arena Allocator for the line copy, tokens and segments
+ * @param src Line to lex (need not be NUL terminated)
+ * @param len Number of bytes in src
+ * @param max_segs Maximum number of pipeline segments (<= 0: unlimited)
+ * @param cl Output command line
+ * @return LEX_OK or the reason the line could not be lexed
+ */
+LexStatus lex_line(Arena *arena, const char *src, size_t len, int max_segs, CommandLine *cl)
+{
+  memset(cl, 0, sizeof(*cl));
+  while (len && isspace((unsigned char)*src))
+  {
+    src++;
+    len--;
+  }
+  while (len && isspace((unsigned char)src[len - 1]))
+    len--;
+  if (len == 0)
+    return LEX_EMPTY;
+
+  // The trimmed line and the token store share one allocation; tokens
+  // never need more bytes than the text they came from.
+  char *mem = arena_alloc(arena, 2 * (len + 1));
+  memcpy(mem, src, len);
+  mem[len] = '\0';
+  cl->line = mem;
+  cl->len = len;
+  cl->store = mem + len + 1;
+
+  const char *p = cl->line;
+  const char *end = p + len;
+  if (end[-1] == '&')
+  { // cannot be quoted: a closed quote would end the line with '
+    cl->background = 1;
+    end--;
+  }
+  char *out = cl->store;
+  size_t ntok = 0;
+  int empty_seg = 0;
+  Segment *seg = push_segment(arena, cl);
+
+  while (1)
+  {
+    while (p < end && isspace((unsigned char)*p))
+      p++;
+    if (p == end)
+      break;
+
+    if (*p == '|')
+    {
+      if (seg->argc == seg->nassign)
+        empty_seg = 1;
+      seg = push_segment(arena, cl);
+      p++;
+      continue;
+    }
+
+    const char *raw = p;
+    char *tok = out;
+    if (*p == '\'')
+    {
+      const char *close = memchr(p + 1, '\'', (size_t)(end - p - 1));
+      if (!close)
+        return LEX_MISSING_QUOTE;
+      memcpy(out, p + 1, (size_t)(close - p - 1));
+      out += close - p - 1;
+      p = close + 1;
+    }
+    else
+    {
+      int has_expand = 0;
+      while (p < end && !isspace((unsigned char)*p) && *p != '|')
+      {
+        if (*p == '$' && p + 1 < end && p[1] == '(')
+        {
+          const char *close = lex_subst_end(p + 1, end);
+          if (!close)
+            return LEX_UNMATCHED_PAREN;
+          memcpy(out, p, (size_t)(close + 1 - p));
+          out += close + 1 - p;
+          p = close + 1;
+          has_expand = 1;
+          continue;
+        }
+        if (*p == '$' && p + 1 < end && (p[1] == '{' || p[1] == '_' || isalpha((unsigned char)p[1])))
+          has_expand = 1;
+        *out++ = *p++;
+      }
+      if (has_expand)
+        push_expand(arena, cl, ntok);
+    }
+    *out++ = '\0';
+    ntok++;
+
+    if (seg->argc++ == 0)
+      seg->text = raw;
+    if (seg->nassign == seg->argc - 1)
+    {
+      size_t name_len = lex_name_len(tok);
+      if (name_len > 0 && tok[name_len] == '=')
+        seg->nassign++;
+      else
+      { // the command word
+        seg->cmd_off = (size_t)(raw - seg->text);
+        seg->cmd_len = (size_t)(p - raw);
+      }
+    }
+    seg->text_len = (size_t)(p - seg->text);
+  }
+
+  if (seg->argc == 0 || (cl->nsegs > 1 && seg->argc == seg->nassign))
+    empty_seg = 1; // trailing `|` (a blank line was handled above)
+  if (empty_seg)
+    return LEX_EMPTY_SEGMENT;
+  if (max_segs > 0 && cl->nsegs > max_segs)
+    return LEX_TOO_MANY_SEGMENTS;
+
+  // Carve every argv (plus its NULL terminator) out of the segment block
+  size_t seg_bytes = sizeof(Segment) * cl->nsegs;
+  Segment *segs = arena_realloc(arena, cl->segs, sizeof(Segment) * cl->seg_cap,
+                                seg_bytes + sizeof(char *) * (ntok + cl->nsegs));
+  cl->segs = segs;
+  char **argv = (char **)((char *)segs + seg_bytes);
+  char *tok = cl->store;
+  for (int i = 0; i < cl->nsegs; i++)
+  {
+    segs[i].assign = argv;
+    segs[i].argv = argv + segs[i].nassign;
+    for (int j = 0; j < segs[i].argc; j++)
+    {
+      *argv++ = tok;
+      tok += strlen(tok) + 1;
+    }
+    *argv++ = NULL;
+    segs[i].argc -= segs[i].nassign;
+  }
+  return LEX_OK;
+}
@@ -0,0 +1,57 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "arena.h"
+#include <stddef.h>
+
+// Result of lexing a command line
+typedef enum {
+    LEX_OK = 0,
+    LEX_EMPTY,           // nothing but whitespace
+    LEX_MISSING_QUOTE,   // a single quote was never closed
+    LEX_EMPTY_SEGMENT,   // `a | | b`, `| a` or `a |`
+    LEX_TOO_MANY_SEGMENTS,
+    LEX_UNMATCHED_PAREN  // a `$(` was never closed
+} LexStatus;
+
+// One command of a pipeline
+typedef struct {
+    char **argv;          // NULL terminated, points into the token store
+    int argc;
+    char **assign;        // leading NAME=value words (not part of argv)
+    int nassign;
+    const char *text;     // raw text of the segment inside CommandLine.line
+    size_t text_len;
+    size_t cmd_off;       // raw offset of the command word in text
+    size_t cmd_len;       // raw length of the command word (quotes included)
+} Segment;
+
+// A lexed command line: one pipeline of segments
+typedef struct {
+    char *line;           // whitespace-trimmed copy of the source line
+    size_t len;
+    Segment *segs;
+    int nsegs;
+    char *store;          // token bytes, each token NUL terminated
+    int seg_cap;
+    int background;       // the line ended with `&` (not part of any segment)
+    int *expand;          // indices of the words (assignments included, over all
+    int nexpand;          // segments) with an unquoted $NAME, ${NAME} or $(...)
+} CommandLine;
+
+// Lex `len` bytes of src in a single pass (max_segs <= 0 means no limit).
+// Everything is allocated from `arena` and lives until it is reset.
+// cl->line is valid for every status except LEX_EMPTY and LEX_MISSING_QUOTE;
+// segs are only filled in on LEX_OK. A segment may consist of assignments
+// only (argc 0) when it is the only one.
+LexStatus lex_line(Arena *arena, const char *src, size_t len, int max_segs, CommandLine *cl);
+
+// Length of the variable name at s (letters, digits and `_`, not starting
+// with a digit); 0 if s does not start with one
+size_t lex_name_len(const char *s);
+
+// The `)` closing the `$(` whose `(` is at open, or NULL if there is none
+// before end. Nested parentheses and single-quoted text are skipped.
+const char *lex_subst_end(const char *open, const char *end);
+
+#endif // LEXER_H
@@ -0,0 +1,700 @@
+#include "lineedit.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+#define KEY_TAB 9
+
+// Keys decoded from escape sequences (outside the byte range)
+#define KEY_NONE 256
+#define KEY_UP 257
+#define KEY_DOWN 258
+#define KEY_RIGHT 259
+#define KEY_LEFT 260
+#define KEY_HOME 261
+#define KEY_END 262
+#define KEY_DELETE 263
+
+#define LE_MAX_LISTED 200 // candidates printed by a double Tab
+
+/**
+ * @Brief Grow a byte buffer so that it can hold need bytes
+ */
+static void grow(char **buf, size_t *cap, size_t need)
+{
+  if (need <= *cap)
+    return;
+  size_t c = *cap ? *cap : 128;
+  while (c < need)
+    c *= 2;
+  char *b = realloc(*buf, c);
+  if (!b)
+  {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  *buf = b;
+  *cap = c;
+}
+
+/**
+ * @Brief Queue bytes for the terminal
+ */
+static void out(LineEditor *le, const char *s, size_t n)
+{
+  grow(&le->out, &le->out_cap, le->out_len + n);
+  memcpy(le->out + le->out_len, s, n);
+  le->out_len += n;
+}
+
+/**
+ * @Brief Queue a NUL terminated string for the terminal
+ */
+static void outs(LineEditor *le, const char *s)
+{
+  out(le, s, strlen(s));
+}
+
+/**
+ * @Brief Write everything queued in a single write()
+ */
+static void flush_out(LineEditor *le)
+{
+  size_t done = 0;
+  while (done < le->out_len)
+  {
+    ssize_t w = write(le->fd, le->out + done, le->out_len - done);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      break;
+    done += (size_t)w;
+  }
+  le->out_len = 0;
+}
+
+/**
+ * @Brief Replace the line being edited (cursor at the end)
+ */
+static void set_line(LineEditor *le, const char *s, size_t n)
+{
+  grow(&le->buf, &le->cap, n + 1);
+  memmove(le->buf, s, n);
+  le->len = n;
+  le->pos = n;
+  le->buf[n] = '\0';
+}
+
+/**
+ * @Brief Insert n bytes at the cursor
+ */
+static void insert_text(LineEditor *le, const char *s, size_t n)
+{
+  grow(&le->buf, &le->cap, le->len + n + 1);
+  memmove(le->buf + le->pos + n, le->buf + le->pos, le->len - le->pos + 1);
+  memcpy(le->buf + le->pos, s, n);
+  le->len += n;
+  le->pos += n;
+}
+
+/**
+ * @Brief Remove the bytes in [from, to)
+ */
+static void delete_range(LineEditor *le, size_t from, size_t to)
+{
+  memmove(le->buf + from, le->buf + to, le->len - to + 1);
+  le->len -= to - from;
+  if (le->pos > to)
+    le->pos -= to - from;
+  else if (le->pos > from)
+    le->pos = from;
+}
+
+/**
+ * @Brief Read one byte from the terminal
+ *
+ * @return The byte, -2 at end of input or -1 on error
+ */
+static int read_byte(LineEditor *le)
+{
+  unsigned char c;
+  while (1)
+  {
+    ssize_t n = read(le->fd, &c, 1);
+    if (n == 1)
+      return c;
+    if (n == 0)
+      return -2;
+    if (errno != EINTR)
+      return -1;
+  }
+}
+
+/**
+ * @Brief Decode the rest of an escape sequence (ESC already read)
+ *
+ * Understands the CSI and SS3 forms terminals send for the arrow, Home,
+ * End and Delete keys; anything else becomes KEY_NONE.
+ */
+static int read_escape(LineEditor *le)
+{
+  int c = read_byte(le);
+  if (c < 0)
+    return c;
+  if (c == 'O')
+  {
+    c = read_byte(le);
+    if (c < 0)
+      return c;
+  }
+  else if (c == '[')
+  {
+    // numeric parameters, then a final byte in @..~
+    int num = 0;
+    int first = 1;
+    while ((c = read_byte(le)) >= 0 && (c < 0x40 || c > 0x7e))
+    {
+      if (c == ';')
+        first = 0;
+      else if (first && isdigit(c))
+        num = num * 10 + (c - '0');
+    }
+    if (c < 0)
+      return c;
+    if (c == '~')
+    {
+      if (num == 1 || num == 7)
+        return KEY_HOME;
+      if (num == 4 || num == 8)
+        return KEY_END;
+      if (num == 3)
+        return KEY_DELETE;
+      return KEY_NONE;
+    }
+  }
+  else
+  {
+    return KEY_NONE; // Alt-<key>
+  }
+
+  switch (c)
+  {
+  case 'A':
+    return KEY_UP;
+  case 'B':
+    return KEY_DOWN;
+  case 'C':
+    return KEY_RIGHT;
+  case 'D':
+    return KEY_LEFT;
+  case 'H':
+    return KEY_HOME;
+  case 'F':
+    return KEY_END;
+  default:
+    return KEY_NONE;
+  }
+}
+
+/**
+ * @Brief Read a key: a byte, or one of the KEY_* codes above 255
+ */
+static int read_key(LineEditor *le)
+{
+  int c = read_byte(le);
+  return c == KEY_ESC ? read_escape(le) : c;
+}
+
+/**
+ * @Brief Redraw the prompt and the whole line, then place the cursor
+ */
+static void refresh_line(LineEditor *le, const char *prompt)
+{
+  outs(le, "\r");
+  outs(le, prompt);
+  out(le, le->buf, le->len);
+  outs(le, "\033[K");
+  if (le->pos < le->len)
+  {
+    char move[32];
+    snprintf(move, sizeof(move), "\033[%zuD", le->len - le->pos);
+    outs(le, move);
+  }
+  flush_out(le);
+}
+
+/**
+ * @Brief Width of the terminal in columns
+ */
+static size_t term_width(const LineEditor *le)
+{
+  struct winsize ws;
+  if (ioctl(le->fd, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+    return ws.ws_col;
+  return 80;
+}
+
+/**
+ * @Brief Order candidates for qsort
+ */
+static int cmp_items(const void *a, const void *b)
+{
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/**
+ * @Brief Print candidates in columns below the line
+ */
+static void list_completions(LineEditor *le, const LeCompletions *c)
+{
+  size_t shown = c->n < LE_MAX_LISTED ? c->n : LE_MAX_LISTED;
+  size_t width = 0;
+  for (size_t i = 0; i < shown; i++)
+  {
+    size_t l = strlen(c->items[i]);
+    if (l > width)
+      width = l;
+  }
+  width += 2;
+  size_t cols = term_width(le) / width;
+  if (cols == 0)
+    cols = 1;
+
+  outs(le, "\n");
+  for (size_t i = 0; i < shown; i++)
+  {
+    outs(le, c->items[i]);
+    if ((i + 1) % cols == 0 || i + 1 == shown)
+    {
+      outs(le, "\n");
+      continue;
+    }
+    for (size_t pad = strlen(c->items[i]); pad < width; pad++)
+      outs(le, " ");
+  }
+  if (shown < c->n)
+  {
+    char more[64];
+    snprintf(more, sizeof(more), "... and %zu more\n", c->n - shown);
+    outs(le, more);
+  }
+}
+
+/**
+ * @Brief Tab: complete the word before the cursor
+ *
+ * A single candidate is inserted (with a space unless it is a directory),
+ * several are extended to their longest common prefix, and a second Tab
+ * that cannot extend anything lists them.
+ */
+static void complete_word(LineEditor *le, const char *prompt, int again)
+{
+  size_t start = le->pos;
+  while (start > 0 && !isspace((unsigned char)le->buf[start - 1]) && le->buf[start - 1] != '|')
+    start--;
+
+  arena_reset(&le->scratch);
+  LeCompletions c = {&le->scratch, NULL, 0, 0};
+  le->complete(le->buf, start, le->pos, &c);
+  if (c.n == 0)
+  {
+    outs(le, "\a");
+    flush_out(le);
+    return;
+  }
+
+  // Sort and drop duplicates (e.g. an alias named like a command)
+  qsort(c.items, c.n, sizeof(char *), cmp_items);
+  size_t u = 1;
+  for (size_t i = 1; i < c.n; i++)
+  {
+    if (strcmp(c.items[i], c.items[u - 1]) != 0)
+      c.items[u++] = c.items[i];
+  }
+  c.n = u;
+
+  // Longest common prefix: sorted, so the first and last item suffice
+  const char *first = c.items[0], *last = c.items[c.n - 1];
+  size_t lcp = 0;
+  while (first[lcp] && first[lcp] == last[lcp])
+    lcp++;
+
+  size_t wlen = le->pos - start;
+  if (lcp > wlen)
+  {
+    delete_range(le, start, le->pos);
+    insert_text(le, first, lcp);
+  }
+  if (c.n == 1)
+  {
+    if (lcp > 0 && first[lcp - 1] != '/')
+      insert_text(le, " ", 1);
+  }
+  else if (lcp <= wlen)
+  {
+    if (again)
+      list_completions(le, &c);
+    else
+      outs(le, "\a");
+  }
+  refresh_line(le, prompt);
+}
+
+/**
+ * @Brief Up/Down: move through the history
+ *
+ * The line being typed is kept aside while older lines are shown and
+ * comes back when moving past the newest one.
+ */
+static void browse_history(LineEditor *le, History *hist, size_t *idx, int older)
+{
+  size_t count = hist_count(hist);
+  if (older && *idx == 0)
+    return;
+  if (!older && *idx >= count)
+    return;
+
+  if (*idx >= count)
+  { // leaving the new line
+    grow(&le->saved, &le->saved_cap, le->len + 1);
+    memcpy(le->saved, le->buf, le->len + 1);
+    le->saved_len = le->len;
+  }
+  *idx = older ? *idx - 1 : *idx + 1;
+  if (*idx >= count)
+  {
+    set_line(le, le->saved, le->saved_len);
+  }
+  else
+  {
+    const char *h = hist_get(hist, *idx);
+    set_line(le, h, strlen(h));
+  }
+}
+
+/**
+ * @Brief Ctrl-R: reverse incremental search through the history
+ *
+ * Typing narrows the query and keeps the current match while it still
+ * matches; Ctrl-R again moves to an older match. Enter runs the match,
+ * Ctrl-G or Ctrl-C gives the original line back, and any other control
+ * key leaves the match in the line for editing.
+ *
+ * @return 1 if the line should be run right away, 0 to keep editing,
+ *         or the negative read_key() result
+ */
+static int search_history(LineEditor *le, History *hist)
+{
+  char *query = NULL;
+  size_t qlen = 0, qcap = 0;
+  grow(&query, &qcap, 1);
+  query[0] = '\0';
+  long match = -1;
+  int failed = 0;
+  int ret = 0;
+
+  while (1)
+  {
+    const char *shown = match >= 0 ? hist_get(hist, (size_t)match) : "";
+    outs(le, "\r\033[K");
+    outs(le, failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`");
+    out(le, query, qlen);
+    outs(le, "': ");
+    outs(le, shown);
+    flush_out(le);
+
+    int c = read_key(le);
+    if (c < 0)
+    {
+      ret = c;
+      break;
+    }
+    if (c == KEY_CTRL('R'))
+    { // next older match
+      long m = qlen ? hist_find(hist, query, match >= 0 ? (size_t)match : hist_count(hist)) : -1;
+      failed = qlen && m < 0;
+      if (m >= 0)
+        match = m;
+      continue;
+    }
+    if (c == KEY_BACKSPACE || c == KEY_CTRL('H'))
+    {
+      if (qlen > 0)
+        query[--qlen] = '\0';
+      match = qlen ? hist_find(hist, query, hist_count(hist)) : -1;
+      failed = qlen && match < 0;
+      continue;
+    }
+    if (c == KEY_CTRL('G') || c == KEY_CTRL('C'))
+      break; // keep the original line
+    if (c >= 32 && c < 256)
+    { // the current match stays if it still matches
+      grow(&query, &qcap, qlen + 2);
+      query[qlen++] = (char)c;
+      query[qlen] = '\0';
+      long m = hist_find(hist, query, match >= 0 ? (size_t)match + 1 : hist_count(hist));
+      failed = m < 0;
+      if (m >= 0)
+        match = m;
+      continue;
+    }
+
+    // Any other key accepts the match
+    if (match >= 0)
+      set_line(le, shown, strlen(shown));
+    if (c == '\r' || c == '\n')
+      ret = 1;
+    break;
+  }
+  free(query);
+  return ret;
+}
+
+/**
+ * @Brief Set up line editing on a terminal
+ *
+ * @return 0, or -1 if fd is not a terminal
+ */
+int le_init(LineEditor *le, int fd)
+{
+  memset(le, 0, sizeof(*le));
+  le->fd = fd;
+  le->scratch = (Arena)ARENA_INIT(4096);
+  if (!isatty(fd) || tcgetattr(fd, &le->orig) == -1)
+    return -1;
+  grow(&le->buf, &le->cap, 1);
+  le->buf[0] = '\0';
+  return 0;
+}
+
+/**
+ * @Brief Read a line with editing
+ *
+ * The terminal is switched to raw mode (no echo, byte at a time, no
+ * signals from Ctrl-C) for the duration of the call and restored before
+ * returning. Emacs-style keys: Ctrl-A/E/B/F move, Ctrl-K/U/W delete,
+ * Ctrl-P/N (or Up/Down) browse history, Ctrl-L clears the screen.
+ */
+int le_readline(LineEditor *le, const char *prompt, History *hist, const char **line, size_t *len)
+{
+  struct termios raw = le->orig;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if (tcsetattr(le->fd, TCSADRAIN, &raw) == -1)
+    return -1;
+
+  set_line(le, "", 0);
+  outs(le, prompt);
+  flush_out(le);
+
+  size_t hist_idx = hist_count(hist); // == count: the new line
+  int prev = 0;
+  int ret = 1;
+  while (1)
+  {
+    int c = read_key(le);
+    if (c == KEY_CTRL('R'))
+    {
+      c = search_history(le, hist);
+      refresh_line(le, prompt); // show the line as it will run
+      if (c == 0)
+        continue;
+      if (c == 1)
+        c = '\r';
+    }
+
+    if (c < 0)
+    {
+      ret = c == -2 ? 0 : -1;
+      break;
+    }
+    if (c == '\r' || c == '\n')
+      break;
+    if (c == KEY_CTRL('D') && le->len == 0)
+    {
+      ret = 0;
+      break;
+    }
+
+    switch (c)
+    {
+    case KEY_CTRL('C'): // drop the line and start over
+      outs(le, "^C\n");
+      set_line(le, "", 0);
+      hist_idx = hist_count(hist);
+      break;
+    case KEY_BACKSPACE:
+    case KEY_CTRL('H'):
+      if (le->pos > 0)
+        delete_range(le, le->pos - 1, le->pos);
+      break;
+    case KEY_CTRL('D'):
+    case KEY_DELETE:
+      if (le->pos < le->len)
+        delete_range(le, le->pos, le->pos + 1);
+      break;
+    case KEY_CTRL('B'):
+    case KEY_LEFT:
+      if (le->pos > 0)
+        le->pos--;
+      break;
+    case KEY_CTRL('F'):
+    case KEY_RIGHT:
+      if (le->pos < le->len)
+        le->pos++;
+      break;
+    case KEY_CTRL('A'):
+    case KEY_HOME:
+      le->pos = 0;
+      break;
+    case KEY_CTRL('E'):
+    case KEY_END:
+      le->pos = le->len;
+      break;
+    case KEY_CTRL('K'):
+      delete_range(le, le->pos, le->len);
+      break;
+    case KEY_CTRL('U'):
+      delete_range(le, 0, le->pos);
+      break;
+    case KEY_CTRL('W'):
+    {
+      size_t from = le->pos;
+      while (from > 0 && isspace((unsigned char)le->buf[from - 1]))
+        from--;
+      while (from > 0 && !isspace((unsigned char)le->buf[from - 1]))
+        from--;
+      delete_range(le, from, le->pos);
+      break;
+    }
+    case KEY_CTRL('L'):
+      outs(le, "\033[H\033[2J");
+      break;
+    case KEY_CTRL('P'):
+    case KEY_UP:
+      browse_history(le, hist, &hist_idx, 1);
+      break;
+    case KEY_CTRL('N'):
+    case KEY_DOWN:
+      browse_history(le, hist, &hist_idx, 0);
+      break;
+    case KEY_TAB:
+      if (le->complete)
+        complete_word(le, prompt, prev == KEY_TAB);
+      prev = c;
+      continue;
+    default:
+      if (c < 32 || c > 255)
+        break; // not bound
+      char ch = (char)c;
+      int at_end = le->pos == le->len;
+      insert_text(le, &ch, 1);
+      if (at_end)
+      { // typing at the end only needs the new byte echoed
+        out(le, &ch, 1);
+        flush_out(le);
+        prev = c;
+        continue;
+      }
+      break;
+    }
+    refresh_line(le, prompt);
+    prev = c;
+  }
+
+  if (ret == 1)
+  {
+    outs(le, "\n");
+    flush_out(le);
+  }
+  tcsetattr(le->fd, TCSADRAIN, &le->orig);
+  *line = le->buf;
+  *len = le->len;
+  return ret;
+}
+
+/**
+ * @Brief Add a completion candidate
+ */
+void le_add_completion(LeCompletions *c, const char *s, size_t len)
+{
+  if (c->n == c->cap)
+  {
+    size_t cap = c->cap ? c->cap * 2 : 16;
+    c->items = arena_realloc(c->arena, c->items, sizeof(char *) * c->cap, sizeof(char *) * cap);
+    c->cap = cap;
+  }
+  c->items[c->n++] = arena_strndup(c->arena, s, len);
+}
+
+/**
+ * @Brief Complete a path: the entries of word's directory that start with
+ * its last component
+ *
+ * Hidden entries are only offered when the component starts with '.'.
+ */
+void le_complete_files(LeCompletions *c, const char *word, size_t len)
+{
+  size_t dir_len = len;
+  while (dir_len > 0 && word[dir_len - 1] != '/')
+    dir_len--; // keeps the '/'
+  const char *base = word + dir_len;
+  size_t base_len = len - dir_len;
+
+  const char *dir = dir_len ? arena_strndup(c->arena, word, dir_len) : ".";
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL)
+  {
+    if (strncmp(e->d_name, base, base_len) != 0)
+      continue;
+    if (e->d_name[0] == '.' && (base_len == 0 || base[0] != '.'))
+      continue;
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+      continue;
+
+    int is_dir = e->d_type == DT_DIR;
+    if (e->d_type == DT_LNK || e->d_type == DT_UNKNOWN)
+    {
+      struct stat st;
+      is_dir = fstatat(dirfd(d), e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+    }
+    size_t name_len = strlen(e->d_name);
+    char *cand = arena_alloc(c->arena, dir_len + name_len + 2);
+    memcpy(cand, word, dir_len);
+    memcpy(cand + dir_len, e->d_name, name_len);
+    size_t n = dir_len + name_len;
+    if (is_dir)
+      cand[n++] = '/';
+    le_add_completion(c, cand, n);
+  }
+  closedir(d);
+}
+
+/**
+ * @Brief Free the editor's buffers
+ */
+void le_free(LineEditor *le)
+{
+  free(le->buf);
+  free(le->saved);
+  free(le->out);
+  arena_free(&le->scratch);
+  le->buf = le->saved = le->out = NULL;
+  le->len = le->cap = le->pos = 0;
+  le->saved_len = le->saved_cap = 0;
+  le->out_len = le->out_cap = 0;
+}
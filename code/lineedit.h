@@ -0,0 +1,59 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include "arena.h"
+#include "history.h"
+#include <stddef.h>
+#include <termios.h>
+
+// Candidates for the word being completed; they live in arena until the
+// next completion
+typedef struct {
+    Arena *arena;
+    const char **items;
+    size_t n;
+    size_t cap;
+} LeCompletions;
+
+// Fill out with the candidates for line[start, end), the word before the
+// cursor. Candidates replace the whole word.
+typedef void (*le_complete_fn)(const char *line, size_t start, size_t end, LeCompletions *out);
+
+// Interactive line editor for a terminal. The terminal is only in raw
+// mode while a line is being read, so commands run with normal settings.
+typedef struct {
+    int fd;               // terminal used for input and output
+    struct termios orig;  // settings to restore after each line
+    char *buf;            // line being edited, NUL terminated
+    size_t len;
+    size_t cap;
+    size_t pos;           // cursor position in buf
+    char *saved;          // the new line, while browsing history
+    size_t saved_len;
+    size_t saved_cap;
+    char *out;            // pending terminal output
+    size_t out_len;
+    size_t out_cap;
+    le_complete_fn complete; // Tab (NULL: no completion)
+    Arena scratch;        // completion candidates
+} LineEditor;
+
+// Use fd for line editing. Returns 0, or -1 if fd is not a terminal.
+int le_init(LineEditor *le, int fd);
+
+// Print prompt and read one line. Up/Down browse hist, Ctrl-R searches it
+// and Tab completes through le->complete. Returns 1 for a line (valid
+// until the next call), 0 at end of input (Ctrl-D on an empty line) and
+// -1 on a read error.
+int le_readline(LineEditor *le, const char *prompt, History *hist, const char **line, size_t *len);
+
+// Add a completion candidate (copied; need not be NUL terminated)
+void le_add_completion(LeCompletions *c, const char *s, size_t len);
+
+// Add the files matching word (a path prefix); directories get a trailing '/'
+void le_complete_files(LeCompletions *c, const char *word, size_t len);
+
+// Free the editor's buffers
+void le_free(LineEditor *le);
+
+#endif // LINEEDIT_H
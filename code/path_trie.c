@@ -0,0 +1,267 @@
+#define _GNU_SOURCE /* strchrnul */
+#include "path_trie.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @Brief Append a node and return its index
+ */
+static int node_new(PathTrie *t, unsigned char byte)
+{
+  if (t->n_nodes == t->cap_nodes)
+  {
+    size_t cap = t->cap_nodes ? t->cap_nodes * 2 : 1024;
+    TrieNode *nodes = realloc(t->nodes, sizeof(TrieNode) * cap);
+    if (!nodes)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    t->nodes = nodes;
+    t->cap_nodes = cap;
+  }
+  TrieNode *n = &t->nodes[t->n_nodes];
+  n->child = -1;
+  n->sibling = -1;
+  n->byte = byte;
+  n->terminal = 0;
+  return (int)t->n_nodes++;
+}
+
+/**
+ * @Brief Child of node with the given byte
+ *
+ * @return The child's index or -1
+ */
+static int find_child(const PathTrie *t, int node, unsigned char byte)
+{
+  int c = t->nodes[node].child;
+  while (c >= 0 && t->nodes[c].byte < byte)
+    c = t->nodes[c].sibling;
+  return c >= 0 && t->nodes[c].byte == byte ? c : -1;
+}
+
+/**
+ * @Brief Child of node with the given byte, created in order if missing
+ */
+static int add_child(PathTrie *t, int node, unsigned char byte)
+{
+  int prev = -1;
+  int c = t->nodes[node].child;
+  while (c >= 0 && t->nodes[c].byte < byte)
+  {
+    prev = c;
+    c = t->nodes[c].sibling;
+  }
+  if (c >= 0 && t->nodes[c].byte == byte)
+    return c;
+
+  int n = node_new(t, byte); // may move t->nodes
+  t->nodes[n].sibling = c;
+  if (prev < 0)
+    t->nodes[node].child = n;
+  else
+    t->nodes[prev].sibling = n;
+  return n;
+}
+
+/**
+ * @Brief Add a name (duplicates from later PATH entries are ignored)
+ */
+static void insert(PathTrie *t, const char *name)
+{
+  int node = 0;
+  for (const char *p = name; *p; p++)
+    node = add_child(t, node, (unsigned char)*p);
+  t->nodes[node].terminal = 1;
+}
+
+/**
+ * @Brief Add every executable file of one directory
+ *
+ * @return 0, or -1 if the directory could not be read
+ */
+static int scan_dir(PathTrie *t, const char *dir)
+{
+  DIR *d = opendir(dir);
+  if (!d)
+    return -1;
+  int dfd = dirfd(d);
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL)
+  {
+    if (e->d_name[0] == '.' && (e->d_name[1] == '\0' || (e->d_name[1] == '.' && e->d_name[2] == '\0')))
+      continue;
+    if (e->d_type == DT_DIR)
+      continue;
+    struct stat st;
+    if (fstatat(dfd, e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111))
+      continue;
+    if (faccessat(dfd, e->d_name, X_OK, 0) == 0)
+      insert(t, e->d_name);
+  }
+  closedir(d);
+  return 0;
+}
+
+/**
+ * @Brief Forget the nodes and directories of the current build
+ */
+static void clear(PathTrie *t)
+{
+  for (size_t i = 0; i < t->n_dirs; i++)
+    free(t->dirs[i].name);
+  free(t->dirs);
+  free(t->path);
+  t->dirs = NULL;
+  t->n_dirs = 0;
+  t->path = NULL;
+  t->n_nodes = 0;
+}
+
+/**
+ * @Brief Scan every directory of path into a fresh trie
+ */
+static void rebuild(PathTrie *t, const char *path)
+{
+  clear(t);
+  node_new(t, 0); // root
+  t->path = strdup(path);
+  t->dirs = calloc(strlen(path) / 2 + 1, sizeof(PathTrieDir)); // upper bound on entries
+  if (!t->path || !t->dirs)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  for (const char *dir = path; *dir;)
+  {
+    const char *colon = strchrnul(dir, ':');
+    if (colon > dir)
+    {
+      PathTrieDir *pd = &t->dirs[t->n_dirs];
+      pd->name = strndup(dir, (size_t)(colon - dir));
+      if (!pd->name)
+      {
+        perror("strndup");
+        exit(EXIT_FAILURE);
+      }
+      struct stat st;
+      // mtime before the scan: a change during the scan triggers a rescan
+      pd->scanned = stat(pd->name, &st) == 0 && scan_dir(t, pd->name) == 0;
+      if (pd->scanned)
+        pd->mtime = st.st_mtim;
+      t->n_dirs++;
+    }
+    dir = *colon ? colon + 1 : colon;
+  }
+  t->stale = 0;
+}
+
+/**
+ * @Brief Check whether a rebuild is needed
+ *
+ * Costs one stat() per PATH directory, no directory scans.
+ */
+static int needs_rebuild(const PathTrie *t, const char *path)
+{
+  if (t->stale || !t->path || strcmp(t->path, path) != 0)
+    return 1;
+  for (size_t i = 0; i < t->n_dirs; i++)
+  {
+    const PathTrieDir *pd = &t->dirs[i];
+    struct stat st;
+    int ok = stat(pd->name, &st) == 0;
+    if (ok != pd->scanned)
+      return 1;
+    if (ok && (st.st_mtim.tv_sec != pd->mtime.tv_sec || st.st_mtim.tv_nsec != pd->mtime.tv_nsec))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @Brief Mark the trie out of date
+ */
+void pt_invalidate(PathTrie *t)
+{
+  t->stale = 1;
+}
+
+/**
+ * @Brief Make sure the trie matches the current PATH and directories
+ */
+void pt_refresh(PathTrie *t, const char *path)
+{
+  if (!path)
+    path = "";
+  if (needs_rebuild(t, path))
+    rebuild(t, path);
+}
+
+/**
+ * @Brief Emit the names below node, extending buf from depth on
+ */
+static size_t emit_all(const PathTrie *t, int node, char *buf, size_t depth, pt_emit_fn emit, void *ctx)
+{
+  size_t n = 0;
+  if (t->nodes[node].terminal)
+  {
+    emit(buf, depth, ctx);
+    n++;
+  }
+  if (depth >= NAME_MAX)
+    return n;
+  for (int c = t->nodes[node].child; c >= 0; c = t->nodes[c].sibling)
+  {
+    buf[depth] = (char)t->nodes[c].byte;
+    n += emit_all(t, c, buf, depth + 1, emit, ctx);
+  }
+  return n;
+}
+
+/**
+ * @Brief Find every executable whose name starts with prefix
+ *
+ * Walks down to the prefix's node, then only visits the names below it,
+ * so the cost depends on the number of matches, not on the size of PATH.
+ *
+ * @param t The trie (see pt_refresh)
+ * @param prefix Start of the name
+ * @param len Length of prefix
+ * @param emit Called once per name; the name is not NUL terminated
+ * @param ctx Passed to emit
+ * @return Number of names emitted
+ */
+size_t pt_complete(const PathTrie *t, const char *prefix, size_t len, pt_emit_fn emit, void *ctx)
+{
+  if (t->n_nodes == 0 || len > NAME_MAX)
+    return 0;
+  int node = 0;
+  for (size_t i = 0; i < len && node >= 0; i++)
+    node = find_child(t, node, (unsigned char)prefix[i]);
+  if (node < 0)
+    return 0;
+
+  char buf[NAME_MAX + 1];
+  memcpy(buf, prefix, len);
+  return emit_all(t, node, buf, len, emit, ctx);
+}
+
+/**
+ * @Brief Free the trie
+ */
+void pt_free(PathTrie *t)
+{
+  clear(t);
+  free(t->nodes);
+  t->nodes = NULL;
+  t->cap_nodes = 0;
+  t->stale = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef PATH_TRIE_H
+#define PATH_TRIE_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Trie node; children are a sorted sibling list (indices, -1 for none)
+typedef struct {
+    int child;
+    int sibling;
+    unsigned char byte;
+    unsigned char terminal; // a name ends here
+} TrieNode;
+
+// A PATH directory and the mtime it had when it was scanned
+typedef struct {
+    char *name;
+    struct timespec mtime;
+    int scanned;            // 0 if it could not be opened
+} PathTrieDir;
+
+// Prefix trie of the executable names found in $PATH. Rebuilt only when
+// PATH changes or one of its directories is modified.
+typedef struct {
+    TrieNode *nodes;        // nodes[0] is the root
+    size_t n_nodes;
+    size_t cap_nodes;
+    char *path;             // PATH the trie was built from
+    PathTrieDir *dirs;
+    size_t n_dirs;
+    int stale;              // set by pt_invalidate
+} PathTrie;
+
+#define PATH_TRIE_INIT {NULL, 0, 0, NULL, NULL, 0, 0}
+
+// Called for each name found by pt_complete
+typedef void (*pt_emit_fn)(const char *name, size_t len, void *ctx);
+
+// Force a rebuild on the next pt_refresh (e.g. after `path` changed PATH)
+void pt_invalidate(PathTrie *t);
+
+// Rebuild the trie if path (the current PATH, NULL if unset), a directory's
+// mtime or pt_invalidate says so
+void pt_refresh(PathTrie *t, const char *path);
+
+// Emit every executable name starting with prefix, in byte order.
+// Returns the number of names emitted.
+size_t pt_complete(const PathTrie *t, const char *prefix, size_t len, pt_emit_fn emit, void *ctx);
+
+// Free the trie
+void pt_free(PathTrie *t);
+
+#endif // PATH_TRIE_H
@@ -0,0 +1,178 @@
+#include "reader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @Brief Set up a reader on an open descriptor
+ *
+ * Regular files are mapped whole; anything else (pipes, terminals) is read
+ * through a buffer that grows only when a single line does not fit.
+ *
+ * @param r The reader
+ * @param fd Descriptor to read from
+ */
+void reader_init_fd(Reader *r, int fd)
+{
+  memset(r, 0, sizeof(*r));
+  r->fd = fd;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  { // size 0 files may still have data (/proc), those use read()
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+      r->map = map;
+      r->map_len = (size_t)st.st_size;
+    }
+  }
+}
+
+/**
+ * @Brief Open a script for reading
+ *
+ * @param r The reader
+ * @param path Script path, or "-" for standard input
+ * @return 0 on success, -1 (errno set) if the file cannot be opened
+ */
+int reader_open(Reader *r, const char *path)
+{
+  if (strcmp(path, "-") == 0)
+  {
+    reader_init_fd(r, STDIN_FILENO);
+    return 0;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  reader_init_fd(r, fd);
+  r->owns_fd = 1;
+  return 0;
+}
+
+/**
+ * @Brief Next line of a mapped file
+ *
+ * Pages before the current line are dropped every READER_RELEASE_BYTES so
+ * that very large scripts run with a flat resident set.
+ */
+static int next_mapped(Reader *r, const char **line, size_t *len)
+{
+  if (r->pos - r->released >= READER_RELEASE_BYTES)
+  {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t upto = r->pos & ~(page - 1);
+    madvise(r->map + r->released, upto - r->released, MADV_DONTNEED);
+    r->released = upto;
+  }
+  if (r->pos >= r->map_len)
+    return 0;
+
+  const char *p = r->map + r->pos;
+  size_t left = r->map_len - r->pos;
+  const char *nl = memchr(p, '\n', left);
+  *line = p;
+  *len = nl ? (size_t)(nl - p) : left;
+  r->pos += *len + (nl ? 1 : 0);
+  return 1;
+}
+
+/**
+ * @Brief Read more data into the buffer, compacting or growing it first
+ *
+ * @return Bytes read, 0 at end of input, -1 on error
+ */
+static ssize_t fill(Reader *r)
+{
+  if (r->start > 0)
+  {
+    memmove(r->buf, r->buf + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+  }
+  if (r->end == r->cap)
+  {
+    size_t cap = r->cap ? r->cap * 2 : READER_BUF_SIZE;
+    char *buf = realloc(r->buf, cap);
+    if (!buf)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    r->buf = buf;
+    r->cap = cap;
+  }
+  ssize_t n;
+  do
+  {
+    n = read(r->fd, r->buf + r->end, r->cap - r->end);
+  } while (n < 0 && errno == EINTR);
+  if (n > 0)
+    r->end += (size_t)n;
+  return n;
+}
+
+/**
+ * @Brief Fetch the next line
+ *
+ * @param r The reader
+ * @param line Set to the start of the line (not NUL terminated)
+ * @param len Set to the line length, excluding the '\n'
+ * @return 1 for a line, 0 at end of input, -1 on a read error
+ */
+int reader_next(Reader *r, const char **line, size_t *len)
+{
+  if (r->map)
+    return next_mapped(r, line, len);
+
+  while (1)
+  {
+    char *p = r->buf + r->start;
+    char *nl = r->end > r->start + r->scanned ? memchr(p + r->scanned, '\n', r->end - r->start - r->scanned) : NULL;
+    if (nl)
+    {
+      *line = p;
+      *len = (size_t)(nl - p);
+      r->start += *len + 1;
+      r->scanned = 0;
+      return 1;
+    }
+    r->scanned = r->end - r->start;
+    if (r->eof)
+    {
+      if (r->start == r->end)
+        return 0;
+      *line = p; // last line without a trailing newline
+      *len = r->end - r->start;
+      r->start = r->end;
+      r->scanned = 0;
+      return 1;
+    }
+    ssize_t n = fill(r);
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      r->eof = 1;
+  }
+}
+
+/**
+ * @Brief Release the reader's resources
+ */
+void reader_close(Reader *r)
+{
+  if (r->map)
+    munmap(r->map, r->map_len);
+  free(r->buf);
+  if (r->owns_fd)
+    close(r->fd);
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+}
@@ -0,0 +1,41 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+
+#define READER_BUF_SIZE (64 * 1024)           // initial read() buffer
+#define READER_RELEASE_BYTES (64 * 1024 * 1024) // drop consumed mmap pages this often
+
+// Line source for scripts and interactive input. Regular files are mmap'd;
+// pipes and terminals go through a growable read() buffer.
+typedef struct {
+    int fd;
+    int owns_fd;
+    // mmap mode
+    char *map;
+    size_t map_len;
+    size_t pos;       // start of the next line
+    size_t released;  // bytes already handed back with madvise
+    // read() mode
+    char *buf;
+    size_t cap;
+    size_t start;     // start of the next line
+    size_t scanned;   // bytes after start known to hold no '\n'
+    size_t end;       // bytes of valid data
+    int eof;
+} Reader;
+
+// Open a script ("-" reads standard input). Returns 0, or -1 with errno set.
+int reader_open(Reader *r, const char *path);
+
+// Read lines from an already open descriptor (not closed by reader_close)
+void reader_init_fd(Reader *r, int fd);
+
+// Fetch the next line (without its '\n'). The view stays valid until the
+// next call. Returns 1 for a line, 0 at end of input, -1 on a read error.
+int reader_next(Reader *r, const char **line, size_t *len);
+
+// Unmap / free buffers and close the descriptor if it was opened here
+void reader_close(Reader *r);
+
+#endif // READER_H
@@ -0,0 +1,515 @@
+/*
+ * Deterministic property tests for the shell's data structures and lexer.
+ *
+ * hash_map and the intern table are driven with a seeded random mix of
+ * operations and compared against a plain array; dynamic_array, the string
+ * helpers and lex_line are checked on fixed, randomized and adversarial
+ * inputs (long quote runs, walls of `|`, missing quotes) against a
+ * reference tokenizer. Growth is asserted through heap allocation counts
+ * rather than timings, so a result never depends on machine load: the
+ * lexer must allocate O(log n) times for an n-byte line, join_words once,
+ * and each container at most once per element plus O(log n) for resizing.
+ * `make microbench` keeps the timing-based scaling checks.
+ *
+ * Usage: test_props   (exit status 1 if any property fails)
+ */
+#include "arena.h"
+#include "dynamic_array.h"
+#include "hash_map.h"
+#include "intern.h"
+#include "lexer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCALE_STEP 8      /* size ratio for the growth checks */
+#define RANDOM_LINES 2000 /* random lines compared with the reference lexer */
+
+/* Counting allocator: every heap call of the process, libc's included */
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t n);
+extern void __libc_free(void *p);
+
+static unsigned long n_allocs = 0; /* malloc, calloc and realloc calls */
+static unsigned long n_frees = 0;  /* free calls on non-NULL pointers */
+static int failures = 0;
+
+void *malloc(size_t n)
+{
+  n_allocs++;
+  return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  n_allocs++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n)
+{
+  n_allocs++;
+  return __libc_realloc(p, n);
+}
+
+void free(void *p)
+{
+  n_frees += p != NULL;
+  __libc_free(p);
+}
+
+/* Small xorshift generator: the same inputs on every run */
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static int expect(int ok, const char *what)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "test_props: FAILED: %s\n", what);
+    failures++;
+  }
+  return ok;
+}
+
+/* log2(n) rounded up, for resize allowances */
+static unsigned long log2_ceil(size_t n)
+{
+  unsigned long bits = 0;
+  while (((size_t)1 << bits) < n)
+    bits++;
+  return bits;
+}
+
+/* Keys "k<i>" for i < n, in one block */
+static char **make_keys(size_t n)
+{
+  char **keys = malloc(sizeof(char *) * n);
+  char *buf = malloc(n * 24);
+  if (!keys || !buf)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    keys[i] = buf + i * 24;
+    snprintf(keys[i], 24, "k%zu", i);
+  }
+  return keys;
+}
+
+static void free_keys(char **keys)
+{
+  free(keys[0]);
+  free(keys);
+}
+
+/***************************************************
+ * hash_map
+ ***************************************************/
+
+/* Random put/get/delete mix checked against a plain array */
+static void test_hm_random(size_t n)
+{
+  char **keys = make_keys(n);
+  char *present = calloc(n, 1);
+  HashMap *hm = hm_create();
+  int ok = 1;
+  for (size_t i = 0; i < 8 * n && ok; i++)
+  {
+    size_t k = rng() % n;
+    switch (rng() % 3)
+    {
+    case 0:
+      hm_put(hm, keys[k], keys[k]);
+      present[k] = 1;
+      break;
+    case 1:
+      hm_delete(hm, keys[k]);
+      present[k] = 0;
+      break;
+    default:
+    {
+      char *v = hm_get(hm, keys[k]);
+      ok = expect(present[k] ? v && strcmp(v, keys[k]) == 0 : v == NULL, "hm: get after random ops");
+      break;
+    }
+    }
+  }
+  size_t expected = 0;
+  for (size_t i = 0; i < n; i++)
+    expected += present[i];
+  expect(hm_size(hm) == expected, "hm: size after random ops");
+
+  size_t seen = 0;
+  HashMapIter it;
+  const char *key;
+  void *value;
+  hm_iter_init(&it, hm);
+  while (hm_iter_next(&it, &key, &value))
+  {
+    size_t k = (size_t)strtoul(key + 1, NULL, 10);
+    seen += k < n && present[k] && strcmp(value, key) == 0;
+  }
+  expect(seen == expected, "hm: iteration visits every entry once");
+
+  hm_reset(hm);
+  expect(hm_size(hm) == 0 && hm_get(hm, keys[0]) == NULL, "hm: reset");
+  hm_free(hm);
+  free(present);
+  free_keys(keys);
+}
+
+/* One allocation per new key (key and value share it) plus table growth */
+static void test_hm_allocs(size_t n)
+{
+  char **keys = make_keys(n);
+  HashMap *hm = hm_create();
+  unsigned long a = n_allocs;
+  for (size_t i = 0; i < n; i++)
+    hm_put(hm, keys[i], "v");
+  expect(n_allocs - a <= n + log2_ceil(n) + 2, "hm: allocations for n puts");
+  a = n_allocs;
+  for (size_t i = 0; i < n; i++)
+    hm_get(hm, keys[i]);
+  expect(n_allocs == a, "hm: get does not allocate");
+  hm_free(hm);
+  free_keys(keys);
+}
+
+/***************************************************
+ * intern
+ ***************************************************/
+static void test_intern(size_t n)
+{
+  char **keys = make_keys(n);
+  InternTable t = INTERN_TABLE_INIT;
+  const char **handles = malloc(sizeof(char *) * n);
+  for (size_t i = 0; i < n; i++)
+    handles[i] = intern_cstr(&t, keys[i]);
+  int ok = t.size == n;
+  for (size_t i = 0; i < 4 * n && ok; i++)
+  {
+    size_t k = rng() % n;
+    const char *h = intern(&t, keys[k], strlen(keys[k]));
+    ok = h == handles[k] && strcmp(h, keys[k]) == 0 && intern_len(h) == strlen(keys[k]) &&
+         intern_hash(h) == hm_hash(keys[k]) && intern_find(&t, keys[k], strlen(keys[k])) == h;
+  }
+  expect(ok && t.size == n, "intern: one handle per distinct string");
+  expect(intern_find(&t, "missing", 7) == NULL && t.size == n, "intern: find does not add");
+  expect(intern(&t, "k1x", 2) == handles[1], "intern: length-limited text");
+
+  // An interned map that owns its values frees each one it replaces or drops
+  HashMap *hm = hm_create_interned_with(free);
+  unsigned long a = n_allocs;
+  unsigned long f = n_frees;
+  for (size_t i = 0; i < 4 * n; i++)
+    hm_put_ptr(hm, handles[i % 8], strdup(keys[i % n]));
+  hm_delete(hm, handles[0]);
+  expect(hm_size(hm) == 7 && strcmp(hm_get_ptr(hm, handles[1]), keys[n - 7]) == 0,
+         "intern: map with owned values keeps the last one");
+  expect(n_frees - f == (n_allocs - a) - 7, "intern: map frees replaced and deleted values");
+  hm_free(hm);
+  intern_free(&t);
+  free(handles);
+  free_keys(keys);
+}
+
+/***************************************************
+ * dynamic_array and string helpers
+ ***************************************************/
+static void test_dynamic_array(size_t n)
+{
+  char **keys = make_keys(n);
+  DynamicArray *da = da_create(1);
+  unsigned long a = n_allocs;
+  for (size_t i = 0; i < n; i++)
+    da_put(da, keys[i]);
+  // strdup per element, doubling for the pointer array
+  expect(n_allocs - a <= n + log2_ceil(n) + 1, "da: allocations for n puts");
+  int ok = da->size == n;
+  for (size_t i = 0; i < n && ok; i++)
+    ok = strcmp(da_get(da, i), keys[i]) == 0 && da_get(da, i) != keys[i];
+  expect(ok, "da: put copies in order");
+
+  da_delete(da, n / 2);
+  ok = da->size == n - 1;
+  for (size_t i = 0; i < n - 1 && ok; i++)
+    ok = strcmp(da_get(da, i), keys[i < n / 2 ? i : i + 1]) == 0;
+  expect(ok, "da: delete packs the rest");
+  while (da->size > 0)
+    da_delete(da, da->size - 1);
+  expect(da->size == 0, "da: delete all");
+  da_free(da);
+  free_keys(keys);
+}
+
+static void test_strings(size_t n)
+{
+  char *r = replaceAt("ab$cd", 2, 1, "XYZ");
+  expect(strcmp(r, "abXYZcd") == 0, "replaceAt");
+  free(r);
+  r = replaceKey("ls -l ll", "ll", "X");
+  expect(strcmp(r, "ls -l X") == 0, "replaceKey first match");
+  free(r);
+  r = replaceKey("abc", "zz", "X");
+  expect(strcmp(r, "abc") == 0, "replaceKey no match");
+  free(r);
+  r = append(NULL, "ab");
+  r = append(r, "cd");
+  expect(r && strcmp(r, "abcd") == 0, "append");
+  free(r);
+
+  // The alias builtin joins its words: one allocation whatever their number
+  char **words = malloc(sizeof(char *) * n);
+  for (size_t i = 0; i < n; i++)
+    words[i] = "word";
+  unsigned long a = n_allocs;
+  char *joined = join_words(words, n, " ");
+  expect(n_allocs - a == 1, "join_words allocates once");
+  expect(strlen(joined) == n * 5 - 1 && strncmp(joined, "word word", 9) == 0, "join_words result");
+  free(joined);
+  free(words);
+}
+
+/***************************************************
+ * lexer
+ ***************************************************/
+
+/* Reference lexer for lines of plain words, quotes, spaces and `|` */
+typedef struct {
+  char words[256][256];
+  int seg_of[256];
+  int nwords;
+  int nsegs;
+} RefLine;
+
+static LexStatus ref_lex(const char *line, RefLine *out)
+{
+  memset(out, 0, sizeof(*out));
+  const char *p = line;
+  const char *end = line + strlen(line);
+  while (p < end && *p == ' ')
+    p++;
+  while (end > p && end[-1] == ' ')
+    end--;
+  if (p == end)
+    return LEX_EMPTY;
+  int empty_seg = 0;
+  int seg_words = 0;
+  out->nsegs = 1;
+  while (1)
+  {
+    while (p < end && *p == ' ')
+      p++;
+    if (p == end)
+      break;
+    if (*p == '|')
+    {
+      empty_seg |= seg_words == 0;
+      out->nsegs++;
+      seg_words = 0;
+      p++;
+      continue;
+    }
+    char *w = out->words[out->nwords];
+    if (*p == '\'')
+    { // a quote only opens at the start of a word
+      const char *close = memchr(p + 1, '\'', (size_t)(end - p - 1));
+      if (!close)
+        return LEX_MISSING_QUOTE;
+      memcpy(w, p + 1, (size_t)(close - p - 1));
+      p = close + 1;
+    }
+    else
+    {
+      size_t len = 0;
+      while (p < end && *p != ' ' && *p != '|')
+        w[len++] = *p++;
+    }
+    out->seg_of[out->nwords++] = out->nsegs - 1;
+    seg_words++;
+  }
+  return empty_seg || seg_words == 0 ? LEX_EMPTY_SEGMENT : LEX_OK;
+}
+
+/* Random line of at most a few hundred bytes, built from short pieces */
+static void random_line(char *line, size_t cap)
+{
+  static const char *pieces[] = {"a", "bc", " ", "  ", "|", "'x y'", "'|'", "''", "-l", "'"};
+  size_t npieces = sizeof(pieces) / sizeof(pieces[0]);
+  size_t len = 0;
+  size_t n = rng() % 40;
+  for (size_t i = 0; i < n; i++)
+  {
+    const char *piece = pieces[rng() % npieces];
+    if (len + strlen(piece) + 1 > cap)
+      break;
+    memcpy(line + len, piece, strlen(piece));
+    len += strlen(piece);
+  }
+  line[len] = '\0';
+}
+
+static void test_lex_random(void)
+{
+  Arena arena = ARENA_INIT(16 * 1024);
+  static RefLine ref;
+  char line[256];
+  int ok = 1;
+  for (int i = 0; i < RANDOM_LINES && ok; i++)
+  {
+    random_line(line, sizeof(line));
+    CommandLine cl;
+    LexStatus st = lex_line(&arena, line, strlen(line), 0, &cl);
+    LexStatus want = ref_lex(line, &ref);
+    ok = st == want;
+    if (ok && st == LEX_OK)
+    {
+      ok = cl.nsegs == ref.nsegs;
+      int w = 0;
+      for (int s = 0; s < cl.nsegs && ok; s++)
+      {
+        ok = cl.segs[s].nassign == 0 && cl.segs[s].argv[cl.segs[s].argc] == NULL;
+        for (int j = 0; j < cl.segs[s].argc && ok; j++, w++)
+          ok = ref.seg_of[w] == s && strcmp(cl.segs[s].argv[j], ref.words[w]) == 0;
+      }
+      ok = ok && w == ref.nwords;
+    }
+    if (!ok)
+      fprintf(stderr, "test_props: lexer disagrees with the reference on [%s]\n", line);
+    arena_reset(&arena);
+  }
+  expect(ok, "lex: random lines match the reference");
+  arena_free(&arena);
+}
+
+/* An adversarial line of size n, lexed with a fresh arena */
+typedef char *(*make_line_fn)(size_t n);
+
+static char *long_quote(size_t n)
+{ // 'aaaa...' as a single quoted word
+  char *line = malloc(n + 3);
+  line[0] = '\'';
+  memset(line + 1, 'a', n);
+  line[n + 1] = '\'';
+  line[n + 2] = '\0';
+  return line;
+}
+
+static char *many_quotes(size_t n)
+{ // 'a' 'a' 'a' ...
+  char *line = malloc(n * 4 + 1);
+  for (size_t i = 0; i < n; i++)
+    memcpy(line + i * 4, "'a' ", 4);
+  line[n * 4] = '\0';
+  return line;
+}
+
+static char *many_pipes(size_t n)
+{ // a|a|a|...|a
+  char *line = malloc(n * 2 + 2);
+  for (size_t i = 0; i < n; i++)
+    memcpy(line + i * 2, "a|", 2);
+  line[n * 2] = 'a';
+  line[n * 2 + 1] = '\0';
+  return line;
+}
+
+static char *missing_quote(size_t n)
+{ // a long line ending in an unterminated quote
+  char *line = malloc(n + 3);
+  memset(line, 'a', n);
+  memcpy(line + n, " '", 3);
+  return line;
+}
+
+/* Lex make(n); returns the heap allocations lex_line made */
+static unsigned long lex_allocs(make_line_fn make, size_t n, CommandLine *cl, LexStatus *st, Arena *arena)
+{
+  char *line = make(n);
+  unsigned long a = n_allocs;
+  *st = lex_line(arena, line, strlen(line), 0, cl);
+  a = n_allocs - a;
+  free(line);
+  return a;
+}
+
+static void test_lex_adversarial(size_t n)
+{
+  static const struct {
+    const char *name;
+    make_line_fn make;
+  } cases[] = {
+    {"lex: one long quote", long_quote},
+    {"lex: many quotes", many_quotes},
+    {"lex: many pipes", many_pipes},
+    {"lex: missing quote", missing_quote},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+  {
+    Arena small_arena = ARENA_INIT(16 * 1024);
+    Arena large_arena = ARENA_INIT(16 * 1024);
+    CommandLine small, large;
+    LexStatus small_st, large_st;
+    unsigned long small_allocs = lex_allocs(cases[i].make, n, &small, &small_st, &small_arena);
+    unsigned long large_allocs = lex_allocs(cases[i].make, n * SCALE_STEP, &large, &large_st, &large_arena);
+    // Arena growth doubles: SCALE_STEP times the input costs a few more blocks
+    if (!expect(large_allocs <= small_allocs + 2 * log2_ceil(SCALE_STEP) + 2, cases[i].name))
+      fprintf(stderr, "test_props: %lu allocations at n, %lu at %d n\n", small_allocs, large_allocs, SCALE_STEP);
+
+    size_t m = n * SCALE_STEP;
+    if (cases[i].make == long_quote)
+      expect(large_st == LEX_OK && large.nsegs == 1 && large.segs[0].argc == 1 &&
+             strlen(large.segs[0].argv[0]) == m, "lex: long quote is one word");
+    else if (cases[i].make == many_quotes)
+      expect(large_st == LEX_OK && large.nsegs == 1 && (size_t)large.segs[0].argc == m &&
+             strcmp(large.segs[0].argv[m - 1], "a") == 0, "lex: many quotes are many words");
+    else if (cases[i].make == many_pipes)
+      expect(large_st == LEX_OK && (size_t)large.nsegs == m + 1 && large.segs[m].argc == 1, "lex: one segment per pipe");
+    else
+      expect(large_st == LEX_MISSING_QUOTE && small_st == LEX_MISSING_QUOTE, "lex: missing quote reported");
+    arena_free(&small_arena);
+    arena_free(&large_arena);
+  }
+
+  Arena arena = ARENA_INIT(16 * 1024);
+  CommandLine cl;
+  expect(lex_line(&arena, "a | | b", 7, 0, &cl) == LEX_EMPTY_SEGMENT, "lex: empty middle segment");
+  expect(lex_line(&arena, "a | b", 5, 1, &cl) == LEX_TOO_MANY_SEGMENTS, "lex: segment limit");
+  expect(lex_line(&arena, "X=1 Y=2 env x &", 15, 0, &cl) == LEX_OK && cl.background &&
+         cl.segs[0].nassign == 2 && cl.segs[0].argc == 2 && strcmp(cl.segs[0].argv[0], "env") == 0,
+         "lex: assignments and background");
+  expect(lex_line(&arena, "echo $(a | b) '$x' $y", 21, 0, &cl) == LEX_OK && cl.nsegs == 1 &&
+         cl.nexpand == 2 && cl.expand[0] == 1 && cl.expand[1] == 3, "lex: substitution and expansion marks");
+  expect(lex_line(&arena, "echo $(a", 8, 0, &cl) == LEX_UNMATCHED_PAREN, "lex: unmatched parenthesis");
+  arena_free(&arena);
+}
+
+int main(void)
+{
+  test_hm_random(1 << 12);
+  test_hm_allocs(1 << 14);
+  test_intern(1 << 12);
+  test_dynamic_array(1 << 12);
+  test_strings(1 << 15);
+  test_lex_random();
+  test_lex_adversarial(1 << 12);
+  if (failures)
+  {
+    fprintf(stderr, "test_props: %d properties failed\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("test_props: all properties hold\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#!/bin/sh
+# A script's exit status (and what it prints about statuses) must not
+# depend on how it is run: serially, with -j, or compiled.
+# Usage: test_status.sh path/to/wsh
+WSH=${1:-./wsh}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+failed=0
+
+# expect_status NAME WANT SCRIPT_TEXT
+expect_status()
+{
+  printf '%b' "$3" > "$DIR/$1.wsh"
+  "$WSH" --compile "$DIR/$1.wsh" -o "$DIR/$1.wshc" || failed=1
+  for run in "" "-j 2" "-j 4"; do
+    for script in "$DIR/$1.wsh" "$DIR/$1.wshc"; do
+      # shellcheck disable=SC2086 # $run is one option and its value
+      "$WSH" $run "$script" > /dev/null 2>&1
+      got=$?
+      if [ "$got" -ne "$2" ]; then
+        echo "test_status: $1: wsh${run:+ $run} $(basename "$script") exited $got, want $2" >&2
+        failed=1
+      fi
+    done
+  done
+}
+
+# expect_output NAME WANT SCRIPT_TEXT: WANT is the whole stdout
+expect_output()
+{
+  printf '%b' "$3" > "$DIR/$1.wsh"
+  "$WSH" --compile "$DIR/$1.wsh" -o "$DIR/$1.wshc" || failed=1
+  for run in "" "-j 2" "-j 4"; do
+    for script in "$DIR/$1.wsh" "$DIR/$1.wshc"; do
+      # shellcheck disable=SC2086 # $run is one option and its value
+      got=$("$WSH" $run "$script" 2> /dev/null)
+      if [ "$got" != "$(printf '%b' "$2")" ]; then
+        echo "test_status: $1: wsh${run:+ $run} $(basename "$script") printed [$got], want [$2]" >&2
+        failed=1
+      fi
+    done
+  done
+}
+
+expect_status last-fails 1 'true\nls /nonexistent\n'
+expect_status last-succeeds 0 'ls /nonexistent\ntrue\n'
+expect_status last-killed 1 'true\nsh -c '"'"'kill -9 $$'"'"'\n'
+expect_status last-not-found 1 'true\nno-such-command-wsh\n'
+expect_status exit-after-failure 1 'ls /nonexistent\nexit\n'
+expect_status wait-job-failed 1 'sh -c '"'"'exit 3'"'"' &\nwait -n\n'
+expect_status wait-job-succeeded 0 'ls /nonexistent &\ntrue &\nwait %1\nwait\n'
+expect_output pipestatus-after-job '1 0\n4 0 1' 'false | true\npipestatus\nsh -c '"'"'exit 4'"'"' | true | false\necho '"'"'x\npipestatus\n'
+
+if [ "$failed" -ne 0 ]; then
+  exit 1
+fi
+echo "test_status: serial, -j and compiled runs agree"
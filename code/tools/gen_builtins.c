@@ -0,0 +1,62 @@
+/*
+ * Build-time generator for the builtin perfect hash.
+ *
+ * Reads the names from builtins.def and searches for a seed under which
+ * builtin_name_hash() puts every name in its own slot of a power-of-two table.
+ * Writes a header with the seed and the slot -> table index map to stdout.
+ */
+#include "builtins.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *names[] = {
+#define BUILTIN(name, handler, flags) #name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+#define COUNT (sizeof(names) / sizeof(names[0]))
+#define MAX_SEEDS 10000000u
+
+int main(void)
+{
+  size_t size = 1;
+  while (size < 2 * COUNT)
+    size *= 2;
+
+  signed char slots[256];
+  if (size > sizeof(slots))
+  {
+    fprintf(stderr, "gen_builtins: too many builtins\n");
+    return EXIT_FAILURE;
+  }
+
+  for (unsigned int seed = 2166136261u, tries = 0; tries < MAX_SEEDS; seed++, tries++)
+  {
+    memset(slots, -1, size);
+    size_t i;
+    for (i = 0; i < COUNT; i++)
+    {
+      size_t slot = builtin_name_hash(names[i], seed) & (size - 1);
+      if (slots[slot] != -1)
+        break;
+      slots[slot] = (signed char)i;
+    }
+    if (i < COUNT)
+      continue;
+
+    printf("/* Generated by tools/gen_builtins.c from builtins.def. Do not edit. */\n");
+    printf("#ifndef BUILTINS_PHF_H\n#define BUILTINS_PHF_H\n\n");
+    printf("#define BUILTIN_PHF_COUNT %zu\n", COUNT);
+    printf("#define BUILTIN_PHF_SEED %uu\n", seed);
+    printf("#define BUILTIN_PHF_SIZE %zu\n\n", size);
+    printf("static const signed char builtin_phf_slot[BUILTIN_PHF_SIZE] = {");
+    for (size_t k = 0; k < size; k++)
+      printf("%s%d", k ? ", " : "", slots[k]);
+    printf("};\n\n#endif // BUILTINS_PHF_H\n");
+    return EXIT_SUCCESS;
+  }
+  fprintf(stderr, "gen_builtins: no perfect hash seed found\n");
+  return EXIT_FAILURE;
+}
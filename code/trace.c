@@ -0,0 +1,160 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+int trace_on = 0;
+
+static const char *trace_file = NULL;
+static struct timespec trace_epoch;
+static TraceEvent *events = NULL;
+static size_t n_events = 0;
+static size_t cap_events = 0;
+static size_t dropped = 0;
+
+/**
+ * @Brief Start recording if WSH_TRACE names an output file
+ */
+void trace_init(void)
+{
+  const char *file = getenv("WSH_TRACE");
+  if (!file || !*file)
+    return;
+  trace_file = file;
+  clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+  trace_on = 1;
+}
+
+/**
+ * @Brief Append an event to the in-memory buffer
+ *
+ * The buffer doubles as needed up to TRACE_MAX_EVENTS; nothing is written
+ * out until trace_flush(), so recording costs a clock read and a copy.
+ *
+ * @param name Event name (a string literal)
+ * @param ph Chrome trace phase
+ * @param id Child pid for 'b'/'e' events, 0 otherwise
+ * @param detail Optional text shown in the event's args (NULL for none)
+ */
+void trace_event(const char *name, char ph, int id, const char *detail)
+{
+  if (n_events == cap_events)
+  {
+    if (cap_events == TRACE_MAX_EVENTS)
+    {
+      dropped++;
+      return;
+    }
+    size_t cap = cap_events ? cap_events * 2 : 4096;
+    TraceEvent *grown = realloc(events, sizeof(TraceEvent) * cap);
+    if (!grown)
+    {
+      dropped++;
+      return;
+    }
+    events = grown;
+    cap_events = cap;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  TraceEvent *e = &events[n_events++];
+  e->ts = (double)(now.tv_sec - trace_epoch.tv_sec) * 1e6 + (now.tv_nsec - trace_epoch.tv_nsec) / 1e3;
+  e->name = name;
+  e->id = id;
+  e->ph = ph;
+  e->detail[0] = '\0';
+  if (detail)
+  {
+    strncpy(e->detail, detail, TRACE_DETAIL_LEN - 1);
+    e->detail[TRACE_DETAIL_LEN - 1] = '\0';
+  }
+}
+
+/**
+ * @Brief Write s as a JSON string
+ */
+static void json_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s; s++)
+  {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+/**
+ * @Brief Forget the recorded events and stop recording
+ */
+void trace_disable(void)
+{
+  free(events);
+  events = NULL;
+  n_events = cap_events = dropped = 0;
+  trace_on = 0;
+}
+
+/**
+ * @Brief Write every event recorded so far to the WSH_TRACE file
+ *
+ * Shell phases are duration events on the shell's own track; each child
+ * process is an async span (keyed by its pid) from start to reap.
+ * Recording goes on, and a later call rewrites the whole file.
+ *
+ * @return 0, or -1 if the file could not be written
+ */
+int trace_write(void)
+{
+  if (!trace_on)
+    return 0;
+  FILE *f = fopen(trace_file, "w");
+  if (!f)
+  {
+    perror(trace_file);
+    return -1;
+  }
+
+  int pid = (int)getpid();
+  fputs("{\"traceEvents\":[\n", f);
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"wsh\"}}", pid, pid);
+  for (size_t i = 0; i < n_events; i++)
+  {
+    const TraceEvent *e = &events[i];
+    fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"wsh\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", e->name,
+            e->ph, e->ts, pid, pid);
+    if (e->ph == 'b' || e->ph == 'e')
+      fprintf(f, ",\"id\":%d", e->id);
+    if (e->detail[0])
+    {
+      fputs(",\"args\":{\"cmd\":", f);
+      json_string(f, e->detail);
+      fputc('}', f);
+    }
+    fputc('}', f);
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":%zu}}\n", dropped);
+  if (fclose(f) != 0)
+  {
+    perror(trace_file);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @Brief Write every recorded event to the WSH_TRACE file and stop recording
+ */
+void trace_flush(void)
+{
+  trace_write();
+  trace_disable();
+}
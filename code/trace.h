@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/types.h>
+
+// Opt-in tracing of the command lifecycle. With WSH_TRACE=/path/file.json
+// every phase records begin/end events in memory, and clean_exit writes
+// them out in Chrome trace format (chrome://tracing, Perfetto). Without it
+// each hook is one branch on trace_on and nothing else.
+extern int trace_on;
+
+#define TRACE_MAX_EVENTS (1 << 20) // further events are counted as dropped
+#define TRACE_DETAIL_LEN 48        // bytes of detail kept per event
+
+// One recorded event
+typedef struct {
+    double ts;                      // microseconds since trace_init
+    const char *name;               // string literal, kept by reference
+    int id;                         // child pid for async events
+    char ph;                        // Chrome phase: B, E, b (child start), e (child end)
+    char detail[TRACE_DETAIL_LEN];  // e.g. the command name (copied, may be truncated)
+} TraceEvent;
+
+// Start recording if WSH_TRACE is set
+void trace_init(void);
+
+// Record an event; use the TRACE_* macros so a disabled trace costs nothing
+void trace_event(const char *name, char ph, int id, const char *detail);
+
+// Write the events so far to the WSH_TRACE file and keep recording (e.g.
+// before execve, which only returns if it fails). Returns 0 or -1.
+int trace_write(void);
+
+// Write the events to the WSH_TRACE file and stop recording
+void trace_flush(void);
+
+// Stop recording without writing (e.g. in a forked job)
+void trace_disable(void);
+
+#define TRACE_BEGIN(name) do { if (trace_on) trace_event((name), 'B', 0, NULL); } while (0)
+#define TRACE_BEGIN_CMD(name, cmd) do { if (trace_on) trace_event((name), 'B', 0, (cmd)); } while (0)
+#define TRACE_END(name) do { if (trace_on) trace_event((name), 'E', 0, NULL); } while (0)
+// Lifetime of a child process, from its start until it is reaped
+#define TRACE_CHILD_START(pid, cmd) do { if (trace_on) trace_event("child", 'b', (pid), (cmd)); } while (0)
+#define TRACE_CHILD_END(pid) do { if (trace_on) trace_event("child", 'e', (pid), NULL); } while (0)
+
+#endif // TRACE_H
@@ -50,3 +50,35 @@ char *append(char *dest, const char *src)
   memcpy(new_str + dest_len, src, src_len + 1); // copy including '\0'
   return new_str;
 }
+
+/* Join n words with sep between them into one new string.
+   Sized up front and filled in one pass: building the same string with
+   append() in a loop rescans and reallocates it for every word. */
+char *join_words(char *const *words, size_t n, const char *sep)
+{
+  size_t sep_len = strlen(sep);
+  size_t total = 1;
+  for (size_t i = 0; i < n; i++)
+    total += strlen(words[i]) + (i ? sep_len : 0);
+
+  char *joined = malloc(total);
+  if (joined == NULL)
+  {
+    perror("malloc");
+    exit(-1);
+  }
+  char *out = joined;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (i)
+    {
+      memcpy(out, sep, sep_len);
+      out += sep_len;
+    }
+    size_t len = strlen(words[i]);
+    memcpy(out, words[i], len);
+    out += len;
+  }
+  *out = '\0';
+  return joined;
+}
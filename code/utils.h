@@ -6,3 +6,6 @@ char *replaceKey(const char *command, const char *key, const char *value);
 
 /* Append src to the end of dest */
 char *append(char *dest, const char *src);
+
+/* Join n words with sep between them into one new string */
+char *join_words(char *const *words, size_t n, const char *sep);
@@ -0,0 +1,295 @@
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @Brief Free a variable (HashMap value destructor)
+ */
+static void var_free(void *value)
+{
+  Var *v = value;
+  free(v->entry);
+  free(v);
+}
+
+/**
+ * @Brief Create the map on first use
+ */
+static HashMap *var_map(VarTable *t)
+{
+  if (!t->map)
+    t->map = hm_create_with(var_free);
+  return t->map;
+}
+
+/**
+ * @Brief Import the process environment
+ *
+ * @param t The table
+ * @param env NULL terminated NAME=value strings (e.g. environ)
+ */
+void vars_import(VarTable *t, char *const *env)
+{
+  for (; env && *env; env++)
+  {
+    const char *eq = strchr(*env, '=');
+    if (!eq || eq == *env)
+      continue;
+    char *name = strndup(*env, (size_t)(eq - *env));
+    if (!name)
+    {
+      perror("strndup");
+      exit(EXIT_FAILURE);
+    }
+    vars_set(t, name, eq + 1, 1);
+    free(name);
+  }
+}
+
+/**
+ * @Brief Look a variable up by name
+ */
+const Var *vars_lookup(const VarTable *t, const char *name)
+{
+  return t->map ? hm_get_ptr(t->map, name) : NULL;
+}
+
+/**
+ * @Brief Value of a variable (NULL if unset)
+ */
+const char *vars_get(const VarTable *t, const char *name)
+{
+  const Var *v = vars_lookup(t, name);
+  return v ? v->value : NULL;
+}
+
+/**
+ * @Brief Set a variable
+ *
+ * The entry is rewritten in place (realloc), so the map is only touched
+ * for a new name. envp goes stale only if the variable is or was exported.
+ *
+ * @param t The table
+ * @param name Variable name
+ * @param value New value (copied; must not point into the variable itself)
+ * @param exported 1 to export, 0 to stop exporting, VAR_KEEP to leave as is
+ */
+void vars_set(VarTable *t, const char *name, const char *value, int exported)
+{
+  Var *v = hm_get_ptr(var_map(t), name);
+  if (!v)
+  {
+    v = calloc(1, sizeof(Var));
+    if (!v)
+    {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+    hm_put_ptr(t->map, name, v);
+  }
+
+  size_t name_len = strlen(name);
+  size_t value_len = strlen(value);
+  char *entry = realloc(v->entry, name_len + value_len + 2);
+  if (!entry)
+  {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(entry, name, name_len);
+  entry[name_len] = '=';
+  memcpy(entry + name_len + 1, value, value_len + 1);
+
+  if (v->exported || exported == 1)
+    t->env_stale = 1;
+  v->entry = entry;
+  v->value = entry + name_len + 1;
+  if (exported != VAR_KEEP)
+    v->exported = exported;
+}
+
+/**
+ * @Brief Export a variable that is already set
+ */
+int vars_export(VarTable *t, const char *name)
+{
+  Var *v = t->map ? hm_get_ptr(t->map, name) : NULL;
+  if (!v)
+    return -1;
+  if (!v->exported)
+  {
+    v->exported = 1;
+    t->env_stale = 1;
+  }
+  return 0;
+}
+
+/**
+ * @Brief Remove a variable
+ */
+void vars_unset(VarTable *t, const char *name)
+{
+  const Var *v = vars_lookup(t, name);
+  if (!v)
+    return;
+  if (v->exported)
+    t->env_stale = 1;
+  hm_delete(t->map, name);
+}
+
+/**
+ * @Brief Environment block of the exported variables
+ *
+ * Rebuilt only after an exported variable changed; otherwise the block
+ * from the previous call is returned as is.
+ */
+char **vars_envp(VarTable *t)
+{
+  if (!t->env_stale && t->envp)
+    return t->envp;
+
+  size_t need = (t->map ? hm_size(t->map) : 0) + 1;
+  if (need > t->env_cap)
+  {
+    char **envp = realloc(t->envp, sizeof(char *) * need);
+    if (!envp)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    t->envp = envp;
+    t->env_cap = need;
+  }
+  size_t n = 0;
+  size_t bytes = sizeof(char *);
+  if (t->map)
+  {
+    HashMapIter it;
+    const char *name;
+    void *value;
+    hm_iter_init(&it, t->map);
+    while (hm_iter_next(&it, &name, &value))
+    {
+      const Var *v = value;
+      if (!v->exported)
+        continue;
+      t->envp[n++] = v->entry;
+      bytes += strlen(v->entry) + 1 + sizeof(char *);
+    }
+  }
+  t->envp[n] = NULL;
+  t->env_bytes = bytes;
+  t->env_stale = 0;
+  return t->envp;
+}
+
+/**
+ * @Brief Whether entry assigns the variable named by the first len bytes of name
+ */
+static int same_name(const char *entry, const char *name, size_t len)
+{
+  return strncmp(entry, name, len) == 0 && entry[len] == '=';
+}
+
+/**
+ * @Brief Environment with some assignments on top
+ *
+ * @param t The table
+ * @param arena Allocator for the block (the entries are not copied)
+ * @param assign "NAME=value" strings; a later one wins over an earlier one
+ * @param n Number of assignments
+ * @return The block, valid until the arena is reset or t changes
+ */
+char **vars_envp_with(VarTable *t, Arena *arena, char *const *assign, int n)
+{
+  char **base = vars_envp(t);
+  size_t nbase = 0;
+  while (base[nbase])
+    nbase++;
+
+  char **envp = arena_alloc(arena, sizeof(char *) * (nbase + (size_t)n + 1));
+  size_t k = 0;
+  for (size_t i = 0; i < nbase; i++)
+  {
+    size_t len = (size_t)(strchr(base[i], '=') - base[i]);
+    int overridden = 0;
+    for (int j = 0; j < n && !overridden; j++)
+      overridden = same_name(assign[j], base[i], len);
+    if (!overridden)
+      envp[k++] = base[i];
+  }
+  for (int j = 0; j < n; j++)
+  {
+    size_t len = (size_t)(strchr(assign[j], '=') - assign[j]);
+    int overridden = 0;
+    for (int later = j + 1; later < n && !overridden; later++)
+      overridden = same_name(assign[later], assign[j], len);
+    if (!overridden)
+      envp[k++] = assign[j];
+  }
+  envp[k] = NULL;
+  return envp;
+}
+
+/**
+ * @Brief Order "NAME=value" entries by name
+ */
+static int cmp_entries(const void *a, const void *b)
+{
+  const char *x = *(char *const *)a;
+  const char *y = *(char *const *)b;
+  while (*x == *y && *x != '=')
+  {
+    x++;
+    y++;
+  }
+  return (*x == '=' ? 0 : (unsigned char)*x) - (*y == '=' ? 0 : (unsigned char)*y);
+}
+
+/**
+ * @Brief Print the exported variables as `export NAME='value'` lines
+ */
+void vars_print_exported(const VarTable *t)
+{
+  if (!t->map || hm_size(t->map) == 0)
+    return;
+  const char **entries = malloc(sizeof(char *) * hm_size(t->map));
+  if (!entries)
+  {
+    perror("malloc");
+    return;
+  }
+  size_t n = 0;
+  HashMapIter it;
+  const char *name;
+  void *value;
+  hm_iter_init(&it, t->map);
+  while (hm_iter_next(&it, &name, &value))
+  {
+    const Var *v = value;
+    if (v->exported)
+      entries[n++] = v->entry;
+  }
+  qsort(entries, n, sizeof(char *), cmp_entries);
+  for (size_t i = 0; i < n; i++)
+  {
+    int name_len = (int)(strchr(entries[i], '=') - entries[i]);
+    printf("export %.*s='%s'\n", name_len, entries[i], entries[i] + name_len + 1);
+  }
+  free(entries);
+}
+
+/**
+ * @Brief Free the table
+ */
+void vars_free(VarTable *t)
+{
+  if (t->map)
+    hm_free(t->map);
+  free(t->envp);
+  t->map = NULL;
+  t->envp = NULL;
+  t->env_cap = 0;
+  t->env_stale = 1;
+}
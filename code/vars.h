@@ -0,0 +1,61 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include "arena.h"
+#include "hash_map.h"
+#include <stddef.h>
+
+// A shell variable, stored the way the environment wants it
+typedef struct {
+    char *entry;      // "NAME=value", one allocation
+    char *value;      // points into entry
+    int exported;
+} Var;
+
+// Shell variables plus the environment block made of the exported ones.
+// envp is rebuilt only when an exported variable has changed since the
+// last call to vars_envp, so starting a command never copies anything.
+typedef struct {
+    HashMap *map;     // name -> Var
+    char **envp;      // NULL terminated, points at the exported entries
+    size_t env_cap;
+    size_t env_bytes; // what envp costs in execve: strings, NULs and pointers
+    int env_stale;    // envp no longer matches the exported variables
+} VarTable;
+
+#define VAR_TABLE_INIT {NULL, NULL, 0, 0, 1}
+
+#define VAR_KEEP -1   // vars_set: leave the export flag alone (new: not exported)
+
+// Import every NAME=value of env as an exported variable
+void vars_import(VarTable *t, char *const *env);
+
+// The variable called name (NULL if unset)
+const Var *vars_lookup(const VarTable *t, const char *name);
+
+// Value of name (NULL if unset)
+const char *vars_get(const VarTable *t, const char *name);
+
+// Set name to value; exported is 0, 1 or VAR_KEEP
+void vars_set(VarTable *t, const char *name, const char *value, int exported);
+
+// Export an existing variable; returns 0, or -1 if it is unset
+int vars_export(VarTable *t, const char *name);
+
+// Remove a variable (nothing happens if it is unset)
+void vars_unset(VarTable *t, const char *name);
+
+// Environment for a new process (t->env_bytes is its size)
+char **vars_envp(VarTable *t);
+
+// Environment with n "NAME=value" assignments added on top, allocated from
+// arena; used for a `NAME=value command` prefix
+char **vars_envp_with(VarTable *t, Arena *arena, char *const *assign, int n);
+
+// Print the exported variables sorted by name, as `export` commands
+void vars_print_exported(const VarTable *t);
+
+// Free every variable and the environment block
+void vars_free(VarTable *t);
+
+#endif // VARS_H
@@ -1,125 +1,181 @@
+#define _GNU_SOURCE /* memfd_create */
 #include "wsh.h"
-#include "dynamic_array.h"
+#include "arena.h"
+#include "builtins.h"
+#include "builtins_phf.h"
 #include "utils.h"
 #include "hash_map.h"
+#include "history.h"
+#include "intern.h"
+#include "jobs.h"
+#include "launch.h"
+#include "lexer.h"
+#include "lineedit.h"
+#include "path_trie.h"
+#include "reader.h"
+#include "trace.h"
+#include "vars.h"
+#include "wshc.h"
 #include <ctype.h>
+#include <signal.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
-#define MAX_PIPE_CMDS 128
+#define MAX_ALIAS_DEPTH 16 /* distinct aliases expanded on one line */
+#define JOB_RC_UNCHANGED 3 /* parallel job exit code: line did not set rc */
+#define BG_DONE_KEPT 1024 /* finished background jobs remembered by scripts */
+#define MAX_SUBST_DEPTH 32 /* nested $(...) */
 
 int rc;
-HashMap *alias_hm = NULL;
-DynamicArray *history_da = NULL;
+static InternTable strings = INTERN_TABLE_INIT; /* alias names, command names, resolved paths */
+HashMap *alias_hm = NULL;      /* keyed by interned name, owns its malloc'd values */
+HashMap *path_cache_hm = NULL; /* interned command name -> interned path ("" if not found) */
+static History history = HISTORY_INIT;
+static PathTrie exec_trie = PATH_TRIE_INIT; /* executables on PATH, for completion */
+static Arena line_arena = ARENA_INIT(16 * 1024); /* temporaries of the current line */
+static JobTable bg_jobs = JOB_TABLE_INIT; /* pipelines started with & */
+static VarTable shell_vars = VAR_TABLE_INIT; /* shell variables; the exported ones form the environment */
+static int interactive = 0; /* reading from a terminal: report jobs as they finish */
 static int suppress_history = 0;
+static int opt_pipefail = 0;   /* set -o pipefail: a pipeline fails if any stage fails */
+static int opt_pipecancel = 0; /* set -o pipecancel: stop upstream stages once a stage exits */
+static int *pipe_status = NULL; /* exit code of every stage of the last foreground line */
+static int n_pipe_status = 0;
+static int cap_pipe_status = 0;
+static int subst_depth = 0; /* $(...) running: stdout is captured */
+static int capture_fds[MAX_SUBST_DEPTH]; /* memfd per nesting level, reused */
+static int n_capture_fds = 0;
+static unsigned long path_cache_hits = 0;
+static unsigned long path_cache_misses = 0;
+extern char **environ; /* imported into shell_vars at startup */
+
+/* One stage of a running pipeline */
+typedef struct {
+  const char *path;       /* resolved executable, NULL for a builtin */
+  const Builtin *builtin; /* set when the shell runs the stage itself */
+  pid_t pid;              /* 0 until started, -1 if it failed to start */
+  int out_fd;             /* pipe write end kept for an in-shell builtin */
+  int pidfd;              /* while being reaped, -1 otherwise */
+  int status;             /* wait status once finished */
+} PipelineStage;
+
+/* Resources used by one pipeline stage, collected for `time` */
+typedef struct {
+  struct timespec start;  /* when the stage was started */
+  double wall;            /* seconds from start until it was reaped */
+  struct rusage ru;       /* from wait4 (RUSAGE_SELF delta for an in-shell builtin) */
+} StageUsage;
 
 /***************************************************
  * Helper Functions
  ***************************************************/
+/**
+ * @Brief Close the memfds that capture command substitutions
+ */
+static void close_capture_fds(void)
+{
+  for (int i = 0; i < n_capture_fds; i++)
+    close(capture_fds[i]);
+  n_capture_fds = 0;
+}
+
 /**
  * @Brief Free any allocated global resources
  */
 void wsh_free(void)
 {
-  if (history_da != NULL)
-  {
-    da_free(history_da);
-    history_da = NULL;
-  }
+  close_capture_fds();
+  hist_free(&history);
+  jobs_free(&bg_jobs);
+  free(pipe_status);
+  pipe_status = NULL;
+  n_pipe_status = cap_pipe_status = 0;
+  pt_free(&exec_trie);
+  vars_free(&shell_vars);
   // Free any allocated resources here
   if (alias_hm != NULL)
   {
     hm_free(alias_hm);
     alias_hm = NULL;
   }
+  if (path_cache_hm != NULL)
+  {
+    hm_free(path_cache_hm);
+    path_cache_hm = NULL;
+  }
+  intern_free(&strings);
+  arena_free(&line_arena);
 }
 
 /**
- * @Brief Trim leading and trailing whitespace from a string
+ * @Brief Set a shell variable
+ *
+ * Every persistent change goes through here (and unset_var) so that a new
+ * PATH drops the resolved-command cache and the completion trie.
+ *
+ * @param exported 1 to export, 0 to stop exporting, VAR_KEEP to leave as is
  */
-void trim_whitespace(char *str)
+static void set_var(const char *name, const char *value, int exported)
 {
-  if (!str)
-    return;
-
-  // Trim leading whitespace
-  char *start = str;
-  while (*start && isspace((unsigned char)*start))
-    start++;
-  if (*start == '\0')
+  vars_set(&shell_vars, name, value, exported);
+  if (strcmp(name, "PATH") == 0)
   {
-    *str = '\0';
-    return;
+    hm_reset(path_cache_hm); // resolved locations are stale now
+    pt_invalidate(&exec_trie);
   }
-
-  // Trim trailing whitespace
-  char *end = start + strlen(start) - 1;
-  while (end > start && isspace((unsigned char)*end))
-    end--;
-  *(end + 1) = '\0';
-
-  // Shift the trimmed string to the beginning
-  if (start != str)
-    memmove(str, start, end - start + 2); // +2 to include null terminator
 }
 
 /**
- * @Brief Execute an external command using execv
+ * @Brief Remove a shell variable
  */
-void execute_external_command(char **argv)
+static void unset_var(const char *name)
 {
-  char *cmd = argv[0];
-
-  if (cmd[0] == '/' || (cmd[0] == '.' && cmd[1] == '/'))
+  vars_unset(&shell_vars, name);
+  if (strcmp(name, "PATH") == 0)
   {
-    if (access(cmd, X_OK) == 0)
-    { // Happy(found the executable)
-      execv(cmd, argv);
-      perror("execv");
-      // exit(EXIT_FAILURE);
-      _exit(127);
-    }
-    else
-    {
-      fprintf(stderr, "Command not found or not an executable: %s\n", cmd);
-      // exit(EXIT_FAILURE);
-      _exit(127);
-    }
+    hm_reset(path_cache_hm);
+    pt_invalidate(&exec_trie);
   }
+}
 
-  char *path = getenv("PATH");
-  if (!path || strlen(path) == 0)
-  {
-    fprintf(stderr, "PATH empty or not set\n");
-    // exit(EXIT_FAILURE);
-    _exit(127);
-  }
+/**
+ * @Brief Split a NAME=value word and set the variable
+ */
+static void assign_var(char *word, int exported)
+{
+  size_t len = lex_name_len(word);
+  word[len] = '\0';
+  set_var(word, word + len + 1, exported);
+  word[len] = '=';
+}
 
-  char *paths = strdup(path);
-  char *dir = strtok(paths, ":");
-  while (dir)
+/**
+ * @Brief Handle exit built-in command
+ */
+int builtin_exit(int argc, char **argv)
+{
+  (void)argv;
+  if (argc > 1)
   {
-    char fullpath[1024];
-    snprintf(fullpath, sizeof(fullpath), "%s/%s", dir, cmd);
-    if (access(fullpath, X_OK) == 0)
-    {
-      execv(fullpath, argv);
-      perror("execv");
-      free(paths);
-      // exit(EXIT_FAILURE);
-      _exit(127);
-    }
-    dir = strtok(NULL, ":");
+    fprintf(stderr, "Incorrect usage of exit. Too many arguments\n");
+    return EXIT_FAILURE;
   }
-  fprintf(stderr, "Command not found or not an executable: %s\n", cmd);
-  free(paths);
-  // exit(EXIT_FAILURE);
-  _exit(127);
+  clean_exit(rc);
+  return EXIT_SUCCESS; // not reached
 }
 
 /**
@@ -135,7 +191,7 @@ int built_in_cd(int argc, char **argv)
   const char *dir = NULL;
   if (argc == 1)
   {
-    dir = getenv("HOME");
+    dir = vars_get(&shell_vars, "HOME");
     if (!dir)
     {
       fprintf(stderr, "cd: HOME not set\n");
@@ -166,7 +222,7 @@ int built_in_path(int argc, char **argv)
   }
   if (argc == 1)
   {
-    const char *path = getenv("PATH");
+    const char *path = vars_get(&shell_vars, "PATH");
     if (path != NULL)
     {
       printf("%s\n", path);
@@ -181,45 +237,95 @@ int built_in_path(int argc, char **argv)
     return EXIT_SUCCESS;
   }
 
-  if (setenv("PATH", argv[1], 1) != 0)
-  {
-    perror("setenv");
-    return EXIT_FAILURE;
-  }
+  set_var("PATH", argv[1], 1);
   fflush(stdout);
   return EXIT_SUCCESS;
 }
 /**
  * @Brief Find the full path of a command
+ *
+ * @return The first executable match, allocated from the line arena, or NULL
  */
-static int find_in_path(const char *cmd, char *out, size_t outsz)
+static const char *find_in_path(const char *cmd)
 {
-  const char *path = getenv("PATH");
+  const char *path = vars_get(&shell_vars, "PATH");
   if (!path)
-    return 0;
+    return NULL;
 
-  char *paths = strdup(path);
-  if (!paths)
+  // One candidate buffer large enough for any dir/cmd pair of this PATH
+  size_t cmd_len = strlen(cmd);
+  char *buf = arena_alloc(&line_arena, strlen(path) + cmd_len + 2);
+  for (const char *dir = path; *dir;)
   {
-    perror("strdup");
-    return 0;
+    const char *colon = strchrnul(dir, ':');
+    size_t dir_len = (size_t)(colon - dir);
+    if (dir_len > 0) // empty entries are skipped
+    {
+      memcpy(buf, dir, dir_len);
+      buf[dir_len] = '/';
+      memcpy(buf + dir_len + 1, cmd, cmd_len + 1);
+      if (access(buf, X_OK) == 0)
+        return buf;
+    }
+    dir = *colon ? colon + 1 : colon;
   }
+  return NULL;
+}
+
+/**
+ * @Brief Resolve a command to the executable that would be run for it
+ *
+ * Absolute and relative paths are checked directly. Bare names go through
+ * the resolved-command cache and only walk PATH on a miss; names that are
+ * not found are cached as negative entries ("") as well. Names and paths
+ * are interned, so a command run a million times is stored once and the
+ * cache probe compares pointers.
+ *
+ * @return Path to execute or NULL if the command is not an executable.
+ *         A resolved path is an interned string: it stays valid for good.
+ */
+static const char *resolve_command(const char *cmd)
+{
+  if (cmd[0] == '/' || (cmd[0] == '.' && cmd[1] == '/'))
+    return access(cmd, X_OK) == 0 ? cmd : NULL;
 
-  int found = 0;
-  for (char *dir = strtok(paths, ":"); dir; dir = strtok(NULL, ":"))
+  const char *name = intern_cstr(&strings, cmd);
+  const char *cached = hm_get_ptr(path_cache_hm, name);
+  if (cached)
   {
-    char buf[1024];
-    snprintf(buf, sizeof(buf), "%s/%s", dir, cmd);
-    if (access(buf, X_OK) == 0)
-    {
-      strncpy(out, buf, outsz);
-      out[outsz - 1] = '\0';
-      found = 1;
-      break;
-    }
+    path_cache_hits++;
+    return *cached ? cached : NULL;
   }
-  free(paths);
-  return found;
+  path_cache_misses++;
+
+  const char *full = find_in_path(cmd);
+  const char *path = intern_cstr(&strings, full ? full : "");
+  hm_put_ptr(path_cache_hm, name, (void *)path);
+  return full ? path : NULL;
+}
+
+/**
+ * @Brief Alias value of name (NULL if it is not an alias)
+ *
+ * A name that was never interned cannot be an alias; otherwise its handle
+ * is the key of the alias map.
+ */
+static const char *alias_get(const char *name)
+{
+  const char *key = intern_find(&strings, name, strlen(name));
+  return key ? hm_get_ptr(alias_hm, key) : NULL;
+}
+
+/**
+ * @Brief Report why a command could not be resolved
+ */
+static void warn_not_found(const char *cmd)
+{
+  const char *path = vars_get(&shell_vars, "PATH");
+  if (cmd[0] != '/' && !(cmd[0] == '.' && cmd[1] == '/') && (!path || *path == '\0'))
+    wsh_warn(EMPTY_PATH);
+  else
+    wsh_warn(CMD_NOT_FOUND, cmd);
 }
 
 /**
@@ -227,8 +333,19 @@ static int find_in_path(const char *cmd, char *out, size_t outsz)
  */
 int builtin_is_builtin_name(const char *name)
 {
-  /* Extend this list as you add more builtins */
-  return !strcmp(name, "exit") || !strcmp(name, "cd") || !strcmp(name, "path") || !strcmp(name, "which") || !strcmp(name, "alias") || !strcmp(name, "unalias") || !strcmp(name, "history");
+  /* Builtins are registered in builtins.def */
+  return builtin_lookup(name) != NULL;
+}
+
+/**
+ * @Brief Check if a builtin has to run in the shell after every earlier
+ *        job of a parallel batch: it changes shell state (or exits the
+ *        shell), or it reads the status the previous line left
+ */
+static int builtin_is_barrier(const char *name)
+{
+  const Builtin *b = builtin_lookup(name);
+  return b && (b->flags & (BI_STATE | BI_LAST_STATUS));
 }
 
 /**
@@ -246,7 +363,7 @@ int builtin_which(int argc, char **argv)
 
   if (alias_hm)
   { // Alias
-    char *aval = hm_get(alias_hm, name);
+    const char *aval = alias_get(name);
     if (aval)
     {
       /* wrap command in single quotes per spec */
@@ -263,25 +380,8 @@ int builtin_which(int argc, char **argv)
     return EXIT_SUCCESS;
   }
 
-  if (name[0] == '/' || (name[0] == '.' && name[1] == '/'))
-  { // absolute or relative path
-    if (access(name, X_OK) == 0)
-    {
-      printf("%s: found at %s\n", name, name);
-      fflush(stdout);
-      return EXIT_SUCCESS;
-    }
-    else
-    {
-      
-      printf("%s: not found\n", name);
-      fflush(stdout);
-      return EXIT_FAILURE;
-    }
-  }
-
-  char full[1024]; // search in PATH
-  if (find_in_path(name, full, sizeof(full)))
+  const char *full = resolve_command(name); // absolute, relative or in PATH
+  if (full)
   {
     printf("%s: found at %s\n", name, full);
     fflush(stdout);
@@ -319,15 +419,15 @@ int builtin_alias(int argc, char **argv)
   if (argc == 3)
   { // alias name =
     val = strdup("");
+    if (!val)
+    {
+      perror("strdup");
+      exit(EXIT_FAILURE);
+    }
   }
   else
   {
-    val = strdup(argv[3]);
-    for (int i = 4; i < argc; i++)
-    {
-      val = append(val, " ");
-      val = append(val, argv[i]);
-    }
+    val = join_words(argv + 3, (size_t)(argc - 3), " ");
     if (argc > 4 && (argv[3][0] != '\'' || argv[argc - 1][strlen(argv[argc - 1]) - 1] != '\''))
     {
       fprintf(stderr, "Incorrect usage of alias. Correct format: alias | alias name = 'command'\n");
@@ -344,9 +444,9 @@ int builtin_alias(int argc, char **argv)
     }
   }
 
-  hm_put(alias_hm, argv[1], val);
+  // Values are not interned: every redefinition would leave the old one behind
+  hm_put_ptr(alias_hm, intern_cstr(&strings, argv[1]), val);
   fflush(stdout);
-  free(val);
   return EXIT_SUCCESS;
 }
 /**
@@ -360,8 +460,8 @@ int builtin_unalias(int argc, char **argv)
     return EXIT_FAILURE;
   }
 
-  const char *name = argv[1];
-  if (alias_hm)
+  const char *name = intern_find(&strings, argv[1], strlen(argv[1]));
+  if (alias_hm && name)
   {
     hm_delete(alias_hm, name); // your hashmap delete function handles not-found gracefully
   }
@@ -372,498 +472,1705 @@ int builtin_unalias(int argc, char **argv)
  */
 int builtin_history(int argc, char **argv)
 {
-  size_t effective = history_da ? history_da->size : 0;
+  size_t effective = hist_count(&history);
   if (effective > 0)
-    effective--;
+    effective--; // the history command itself
   if (argc == 1)
   {
     for (size_t i = 0; i < effective; i++)
     {
-      printf("%s\n", da_get(history_da, i));
+      printf("%s\n", hist_get(&history, i));
+    }
+    fflush(stdout);
+    return EXIT_SUCCESS;
+  }
+
+  if (argc == 3 && strcmp(argv[1], "-s") == 0)
+  { // Matches oldest first, numbered for `history n`
+    size_t before = effective;
+    size_t n_found = 0;
+    size_t *found = NULL;
+    long i;
+    while ((i = hist_find(&history, argv[2], before)) >= 0)
+    {
+      found = arena_realloc(&line_arena, found, sizeof(size_t) * n_found, sizeof(size_t) * (n_found + 1));
+      found[n_found++] = (size_t)i;
+      before = (size_t)i;
     }
+    while (n_found-- > 0)
+      printf("%5zu  %s\n", found[n_found] + 1, hist_get(&history, found[n_found]));
     fflush(stdout);
     return EXIT_SUCCESS;
   }
 
   if (argc != 2)
   {
-    fprintf(stderr, "Incorrect usage of history. Correct format: history | history n\n");
+    fprintf(stderr, INVALID_HISTORY_USE);
     return EXIT_FAILURE;
   }
 
   // Parse integer
   char *endptr;
   long n = strtol(argv[1], &endptr, 10);
-  if (*endptr != '\0' || n < 1 || n > (long)history_da->size)
+  if (*endptr != '\0' || n < 1 || n > (long)hist_count(&history))
   {
     fprintf(stderr, "Invalid argument passed to history\n");
     return EXIT_FAILURE;
   }
 
   // Print nth command (1-based index)
-  printf("%s\n", da_get(history_da, n - 1));
+  printf("%s\n", hist_get(&history, (size_t)n - 1));
   fflush(stdout);
   return EXIT_SUCCESS;
 }
 
 /**
- * @Brief Parse a command line into arguments without alias substitution
+ * Brief Handle hash built-in command
  */
-static int split_pipeline(const char *line, char *segments[], int max_segs)
+int builtin_hash(int argc, char **argv)
 {
-  int count = 0;
-  int in_single = 0;
-  const char *seg_start = line;
-
-  for (const char *p = line;; p++)
+  if (argc == 1)
   {
-    char c = *p;
-    if (c == '\'')
-      in_single = !in_single;
-    if ((c == '|' && !in_single) || c == '\0')
-    {
-      if (count >= max_segs)
-        return -1; // too many
-      size_t len = (size_t)(p - seg_start);
-      char *seg = (char *)malloc(len + 1);
-      if (!seg)
-      {
-        perror("malloc");
-        return -1;
-      }
-      memcpy(seg, seg_start, len);
-      seg[len] = '\0';
-      // advance seg_start past the delimiter (if not at end)
-      segments[count++] = seg;
-      if (c == '\0')
-        break;
-      seg_start = p + 1;
-    }
+    printf(HASH_STATS, path_cache_hits, path_cache_misses);
+    fflush(stdout);
+    return EXIT_SUCCESS;
   }
-  return count;
-}
-/**
- * @Brief Trim leading and trailing whitespace in place
- */
-static void trim_inplace(char *s)
-{
-  if (!s)
-    return;
-  char *p = s;
-  while (*p && isspace((unsigned char)*p))
-    p++;
-  if (p != s)
-    memmove(s, p, strlen(p) + 1);
-  size_t n = strlen(s);
-  while (n && isspace((unsigned char)s[n - 1]))
-    s[--n] = '\0';
+  if (argc != 2 || strcmp(argv[1], "-r") != 0)
+  {
+    fprintf(stderr, INVALID_HASH_USE);
+    return EXIT_FAILURE;
+  }
+  // Forget every remembered location
+  hm_reset(path_cache_hm);
+  path_cache_hits = 0;
+  path_cache_misses = 0;
+  return EXIT_SUCCESS;
 }
 
 /**
- * @Brief Expand alias for a single command segment (no pipeline)
+ * @Brief Handle time built-in command used inside a pipeline
+ *
+ * `time` at the start of a line is handled by time_command(), which sees
+ * the whole pipeline; anywhere else it is a usage error.
  */
-static char *expand_alias_for_segment(char *segment)
+int builtin_time(int argc, char **argv)
 {
-  // parse once to get argv[0]
-  int argc = 0;
-  char *argv_local[MAX_ARGS];
-  parseline_no_subst(segment, argv_local, &argc);
-  if (argc == 0)
-  {
-    return strdup(segment);
-  }
-  char *aval = alias_hm ? hm_get(alias_hm, argv_local[0]) : NULL;
-
-  for (int i = 0; i < argc; i++)
-    free(argv_local[i]);
-  if (!aval)
-    return strdup(segment);
-
-
-  const char *p = segment;
-  while (*p && isspace((unsigned char)*p))
-    p++;
-  while (*p && !isspace((unsigned char)*p))
-    p++;                // end first token
-  const char *rest = p; // includes spaces
-  size_t newlen = strlen(aval) + strlen(rest) + 1;
-  char *expanded = (char *)malloc(newlen);
-  if (!expanded)
-  {
-    perror("malloc");
-    return strdup(segment);
-  }
-  strcpy(expanded, aval);
-  strcat(expanded, rest);
-  return expanded;
+  (void)argc;
+  (void)argv;
+  fprintf(stderr, INVALID_TIME_USE);
+  return EXIT_FAILURE;
 }
+
 /**
- * @Brief Check if a command exists (builtin, absolute/relative, or in PATH)
+ * @Brief Print a job's line for `jobs` and completion notices
  */
-static int command_exists(char **argv)
+static void print_job(FILE *out, const Job *job)
 {
-  if (!argv[0] || !*argv[0])
-    return 0;
-
-  // builtin
-  if (builtin_is_builtin_name(argv[0]))
-    return 1;
-
-  // absolute/relative
-  if (argv[0][0] == '/' || (argv[0][0] == '.' && argv[0][1] == '/'))
-    return access(argv[0], X_OK) == 0;
-
-  // PATH
-  char full[1024];
-  return find_in_path(argv[0], full, sizeof(full));
+  if (job->nlive > 0)
+    fprintf(out, JOB_RUNNING, job->id, job->cmd);
+  else if (jobs_exit_status(job) == 0)
+    fprintf(out, JOB_DONE, job->id, job->cmd);
+  else
+    fprintf(out, JOB_EXIT, job->id, jobs_exit_status(job), job->cmd);
 }
 
 /**
- * @Brief Execute a single command (no pipeline)
+ * @Brief Reap finished background jobs (called before each prompt and line)
+ *
+ * A terminal session reports finished jobs and forgets them, as bash does.
+ * Scripts keep them for `jobs` and `wait`, but only the BG_DONE_KEPT most
+ * recent, so a long script of `cmd &` lines does not grow without bound.
  */
-static void exec_one_command(int argc, char **argv)
+static void check_jobs(void)
 {
-  if (argc == 0)
-    _exit(127);
-
-  if (builtin_is_builtin_name(argv[0]))
+  if (jobs_reap(&bg_jobs) == 0)
+    return;
+  size_t done = 0;
+  for (size_t j = bg_jobs.n; j-- > 0;)
   {
-    int code = EXIT_FAILURE;
-    if (!strcmp(argv[0], "cd"))
-      code = built_in_cd(argc, argv);
-    else if (!strcmp(argv[0], "path"))
-      code = built_in_path(argc, argv);
-    else if (!strcmp(argv[0], "which"))
-      code = builtin_which(argc, argv);
-    else if (!strcmp(argv[0], "alias"))
-      code = builtin_alias(argc, argv);
-    else if (!strcmp(argv[0], "unalias"))
-      code = builtin_unalias(argc, argv);
-    else if (!strcmp(argv[0], "history"))
-      code = builtin_history(argc, argv);
-    else if (!strcmp(argv[0], "exit"))
-      code = EXIT_SUCCESS; // ignore in pipeline
-    _exit(code == EXIT_SUCCESS ? 0 : 1);
+    Job *job = &bg_jobs.jobs[j];
+    if (job->nlive > 0)
+      continue;
+    if (interactive)
+      print_job(stderr, job);
+    if (interactive || ++done > BG_DONE_KEPT)
+      jobs_remove(&bg_jobs, job);
   }
-
-  // external
-  execute_external_command(argv); // this _exit(127) on failure
 }
 
 /**
- * @Brief Run a pipeline command line
+ * @Brief Handle jobs built-in command
+ *
+ * Lists the background jobs; finished ones are forgotten once listed.
  */
-static int run_pipeline(const char *line)
+int builtin_jobs(int argc, char **argv)
 {
-  char *segs_raw[MAX_PIPE_CMDS];
-  int n = split_pipeline(line, segs_raw, MAX_PIPE_CMDS);
-  if (n < 0)
+  (void)argv;
+  if (argc != 1)
   {
-    fprintf(stderr, "Empty command segment in pipeline\n");
+    fprintf(stderr, INVALID_JOBS_USE);
     return EXIT_FAILURE;
   }
-  if (n == 1)
-  {
-    free(segs_raw[0]);
-    return -2;
-  } 
-
-  char *segs_expanded[MAX_PIPE_CMDS] = {0};
-  char *argvs[MAX_PIPE_CMDS][MAX_ARGS];
-  int argcs[MAX_PIPE_CMDS];
-  int processed = 0;
-
-  int invalid = 0, empty_seg = 0;
-
-  for (int i = 0; i < n; i++)
+  jobs_reap(&bg_jobs);
+  for (size_t j = 0; j < bg_jobs.n;)
   {
-    trim_inplace(segs_raw[i]);
-    if (segs_raw[i][0] == '\0')
-    {
-      empty_seg = 1;
-      break;
-    }
-
-    segs_expanded[i] = expand_alias_for_segment(segs_raw[i]);
-
-    parseline_no_subst(segs_expanded[i], argvs[i], &argcs[i]);
-
-    if (argcs[i] == 0)
-    {
-      empty_seg = 1;
-      break;
-    }
-
-    if (!command_exists(argvs[i]))
-    {
-      fprintf(stderr, "Command not found or not an executable: %s\n", argvs[i][0]);
-      invalid = 1;
-    }
-    processed = i + 1;
+    Job *job = &bg_jobs.jobs[j];
+    print_job(stdout, job);
+    if (job->nlive == 0)
+      jobs_remove(&bg_jobs, job);
+    else
+      j++;
   }
+  fflush(stdout);
+  return EXIT_SUCCESS;
+}
 
-  if (empty_seg)
-  {
-    fprintf(stderr, "Empty command segment in pipeline\n");
-    for (int i = 0; i < n; i++)
-      free(segs_raw[i]);
-    for (int i = 0; i < processed; i++)
-    {
-      free(segs_expanded[i]);
-      for (int j = 0; j < argcs[i]; j++)
-        free(argvs[i][j]);
-    }
-    return EXIT_FAILURE;
-  }
-  if (invalid)
+/**
+ * @Brief Handle wait built-in command
+ *
+ * `wait` waits for every job, `wait -n` for the next one to finish and
+ * `wait %n|pid ...` for the given jobs. Returns the exit status of the
+ * last job waited for (0 for plain `wait`).
+ */
+int builtin_wait(int argc, char **argv)
+{
+  if (argc == 1)
   {
-    for (int i = 0; i < n; i++)
-      free(segs_raw[i]);
-    for (int i = 0; i < processed; i++)
-    {
-      free(segs_expanded[i]);
-      for (int j = 0; j < argcs[i]; j++)
-        free(argvs[i][j]);
-    }
-    return EXIT_FAILURE;
+    Job *job;
+    while ((job = jobs_wait(&bg_jobs, NULL)) != NULL)
+      jobs_remove(&bg_jobs, job);
+    return EXIT_SUCCESS;
   }
-
-  int pipes[MAX_PIPE_CMDS - 1][2];
-  for (int i = 0; i < n - 1; i++)
+  if (strcmp(argv[1], "-n") == 0)
   {
-    if (pipe(pipes[i]) == -1)
+    if (argc != 2)
     {
-      perror("pipe"); /* cleanup */
-      for (int k = 0; k < n; k++)
-      {
-        free(segs_raw[k]);
-        free(segs_expanded[k]);
-        for (int j = 0; j < argcs[k]; j++)
-          free(argvs[k][j]);
-      }
+      fprintf(stderr, INVALID_WAIT_USE);
       return EXIT_FAILURE;
     }
+    Job *job = jobs_wait(&bg_jobs, NULL);
+    if (!job)
+      return EXIT_FAILURE; // no jobs
+    int code = jobs_exit_status(job);
+    jobs_remove(&bg_jobs, job);
+    return code;
   }
 
-  pid_t pids[MAX_PIPE_CMDS];
-  for (int i = 0; i < n; i++)
+  int code = EXIT_SUCCESS;
+  for (int i = 1; i < argc; i++)
   {
-    pid_t pid = fork();
-    if (pid < 0)
+    char *endptr;
+    const char *num = argv[i][0] == '%' ? argv[i] + 1 : argv[i];
+    long n = strtol(num, &endptr, 10);
+    if (*num == '\0' || *endptr != '\0' || n < 1 || n > INT_MAX)
     {
-      perror("fork"); /* parent error */
+      fprintf(stderr, INVALID_WAIT_USE);
+      return EXIT_FAILURE;
     }
-    if (pid == 0)
+    Job *job = argv[i][0] == '%' ? jobs_find(&bg_jobs, (int)n) : jobs_find_pid(&bg_jobs, (pid_t)n);
+    if (!job)
     {
-      
-      if (i > 0)
-        dup2(pipes[i - 1][0], STDIN_FILENO);
-      if (i < n - 1)
-        dup2(pipes[i][1], STDOUT_FILENO);
-      // close all pipe fds in child
-      for (int k = 0; k < n - 1; k++)
-      {
-        close(pipes[k][0]);
-        close(pipes[k][1]);
-      }
-      // run command (builtins or external)
-      exec_one_command(argcs[i], argvs[i]);
-      _exit(127); // not reached
+      fprintf(stderr, NO_SUCH_JOB, argv[i]);
+      code = EXIT_FAILURE;
+      continue;
     }
-    pids[i] = pid;
-  }
-
-  for (int i = 0; i < n - 1; i++)
-  {
-    close(pipes[i][0]);
-    close(pipes[i][1]);
-  }
-
-  int status = 0;
-  for (int i = 0; i < n; i++)
-  {
-    int st;
-    waitpid(pids[i], &st, 0);
-    if (i == n - 1)
-      status = st;
+    job = jobs_wait(&bg_jobs, job);
+    code = jobs_exit_status(job);
+    jobs_remove(&bg_jobs, job);
   }
-  int result = (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
-
-  for (int i = 0; i < n; i++)
-  {
-    free(segs_raw[i]);
-    free(segs_expanded[i]);
-    for (int j = 0; j < argcs[i]; j++)
-      free(argvs[i][j]);
-  }
-  return result;
+  return code;
 }
 
+/* Options for set -o / set +o */
+static const struct {
+  const char *name;
+  int *value;
+} shell_options[] = {
+    {"pipefail", &opt_pipefail},
+    {"pipecancel", &opt_pipecancel},
+};
+
 /**
- * @Brief Process a command line
+ * @Brief Handle set built-in command
+ *
+ * `set` lists the options, `set -o name` turns one on, `set +o name` off.
  */
-void process_command(const char *cmdline)
+int builtin_set(int argc, char **argv)
 {
-  if (!cmdline)
-    return;
-
-  char *line = strdup(cmdline);
-  if (!line)
-  {
-    perror("strdup");
-    clean_exit(EXIT_FAILURE);
-  }
-
-  trim_whitespace(line);
-  if (strlen(line) == 0)
+  size_t n_options = sizeof(shell_options) / sizeof(shell_options[0]);
+  if (argc == 1)
   {
-    free(line);
-    return; // Ignore empty lines
+    for (size_t i = 0; i < n_options; i++)
+      printf(SET_OPTION, *shell_options[i].value ? '-' : '+', shell_options[i].name);
+    fflush(stdout);
+    return EXIT_SUCCESS;
   }
-
-  int argc = 0;
-  char *argv[MAX_ARGS];
-  parseline_no_subst(line, argv, &argc);
-
-  if (argc == 0)
+  if (argc != 3 || (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0))
   {
-    free(line);
-    return;
+    fprintf(stderr, INVALID_SET_USE);
+    return EXIT_FAILURE;
   }
-
-  int has_bar = 0;
+  for (size_t i = 0; i < n_options; i++)
   {
-    int in_single = 0;
-    for (char *p = line; *p; p++)
+    if (strcmp(argv[2], shell_options[i].name) == 0)
     {
-      if (*p == '\'')
-        in_single = !in_single;
-      else if (*p == '|' && !in_single)
-      {
-        has_bar = 1;
-        break;
-      }
+      *shell_options[i].value = argv[1][0] == '-';
+      return EXIT_SUCCESS;
     }
   }
-  if (has_bar)
+  fprintf(stderr, SET_UNKNOWN_OPTION, argv[2]);
+  return EXIT_FAILURE;
+}
+
+/**
+ * @Brief Handle pipestatus built-in command
+ *
+ * Prints the exit code of every stage of the last foreground line.
+ */
+int builtin_pipestatus(int argc, char **argv)
+{
+  (void)argv;
+  if (argc != 1)
   {
-    if (!suppress_history)
-      da_put(history_da, line);
-    int res = run_pipeline(line);
-    rc = (res == -2) ? rc : res; // -2 means "not actually a pipeline", else set rc
-    free(line);
-    return;
+    fprintf(stderr, INVALID_PIPESTATUS_USE);
+    return EXIT_FAILURE;
   }
+  for (int i = 0; i < n_pipe_status; i++)
+    printf("%s%d", i ? " " : "", pipe_status[i]);
+  printf("\n");
+  fflush(stdout);
+  return EXIT_SUCCESS;
+}
 
-  if (!suppress_history)
+/**
+ * @Brief Handle export built-in command
+ *
+ * `export NAME=value` sets and exports a variable, `export NAME` exports
+ * one that is already set; without arguments the exported variables are
+ * listed.
+ */
+int builtin_export(int argc, char **argv)
+{
+  if (argc == 1)
   {
-    da_put(history_da, line);
+    vars_print_exported(&shell_vars);
+    fflush(stdout);
+    return EXIT_SUCCESS;
   }
-  if (strcmp(argv[0], "exit") == 0)
+  int code = EXIT_SUCCESS;
+  for (int i = 1; i < argc; i++)
   {
-    if (argc > 1)
+    size_t len = lex_name_len(argv[i]);
+    if (len == 0 || (argv[i][len] != '=' && argv[i][len] != '\0'))
     {
-      fprintf(stderr, "Incorrect usage of exit. Too many arguments\n");
-      rc = EXIT_FAILURE;
-      goto cleanup;
+      fprintf(stderr, INVALID_EXPORT_USE);
+      code = EXIT_FAILURE;
     }
-    else
+    else if (argv[i][len] == '=')
+      assign_var(argv[i], 1);
+    else if (vars_export(&shell_vars, argv[i]) != 0)
     {
-      clean_exit(rc);
+      fprintf(stderr, VAR_NOT_SET, argv[i]);
+      code = EXIT_FAILURE;
     }
   }
-  else if (strcmp(argv[0], "cd") == 0)
+  return code;
+}
+
+/**
+ * @Brief Handle unset built-in command
+ */
+int builtin_unset(int argc, char **argv)
+{
+  if (argc == 1)
   {
-    rc = built_in_cd(argc, argv);
-    goto cleanup;
+    fprintf(stderr, INVALID_UNSET_USE);
+    return EXIT_FAILURE;
   }
-  else if (strcmp(argv[0], "path") == 0)
+  int code = EXIT_SUCCESS;
+  for (int i = 1; i < argc; i++)
   {
-    rc = built_in_path(argc, argv);
-    goto cleanup;
+    if (lex_name_len(argv[i]) != strlen(argv[i]))
+    {
+      fprintf(stderr, INVALID_UNSET_USE);
+      code = EXIT_FAILURE;
+      continue;
+    }
+    unset_var(argv[i]);
   }
-  else if (strcmp(argv[0], "which") == 0)
+  return code;
+}
+
+/* Builtin table, in builtins.def order (the generated slots index into it) */
+static const Builtin builtin_table[] = {
+#define BUILTIN(name, handler, flags) {#name, handler, flags},
+#include "builtins.def"
+#undef BUILTIN
+};
+_Static_assert(sizeof(builtin_table) / sizeof(builtin_table[0]) == BUILTIN_PHF_COUNT,
+               "builtins_phf.h is out of date with builtins.def");
+
+/**
+ * @Brief Find a builtin by name
+ *
+ * One hash, one table probe and a single strcmp against the only
+ * candidate, whatever the number of builtins.
+ *
+ * @return The builtin's table entry or NULL
+ */
+const Builtin *builtin_lookup(const char *name)
+{
+  unsigned int slot = builtin_name_hash(name, BUILTIN_PHF_SEED) & (BUILTIN_PHF_SIZE - 1);
+  int i = builtin_phf_slot[slot];
+  if (i < 0 || strcmp(builtin_table[i].name, name) != 0)
+    return NULL;
+  return &builtin_table[i];
+}
+
+/**
+ * @Brief Check if a command exists (builtin, absolute/relative, or in PATH)
+ *
+ * @param path Set to the resolved executable (NULL for builtins)
+ */
+static int command_exists(char **argv, const char **path)
+{
+  *path = NULL;
+  if (!argv[0] || !*argv[0])
+    return 0;
+
+  // builtin
+  if (builtin_is_builtin_name(argv[0]))
+    return 1;
+
+  // absolute/relative or PATH
+  *path = resolve_command(argv[0]);
+  return *path != NULL;
+}
+
+/**
+ * @Brief Run a builtin inside a forked pipeline child and exit with its status
+ *
+ * A NAME=value prefix is simply exported in the child.
+ */
+static void exec_builtin_in_child(const Segment *seg)
+{
+  int argc = seg->argc;
+  char **argv = seg->argv;
+  const Builtin *b = argc > 0 ? builtin_lookup(argv[0]) : NULL;
+  if (!b)
+    _exit(127);
+  for (int i = 0; i < seg->nassign; i++)
+    assign_var(seg->assign[i], 1);
+
+  int code = EXIT_SUCCESS;
+  if (!(b->flags & BI_PIPE_NOOP)) // e.g. exit is ignored in a pipeline
+    code = b->handler(argc, argv);
+  _exit(code == EXIT_SUCCESS ? 0 : 1);
+}
+
+/**
+ * @Brief Longest pipeline the shell will start
+ *
+ * Only a couple of pipes are open at a time, but a builtin stage keeps its
+ * write end until every external stage is running, so the worst case is
+ * one descriptor per stage: stay below RLIMIT_NOFILE.
+ */
+static int max_pipeline_stages(void)
+{
+  static int max_stages = 0;
+  if (max_stages == 0)
+  {
+    struct rlimit rl;
+    rlim_t n = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+      n = rl.rlim_cur;
+    if (n == RLIM_INFINITY || n > INT_MAX)
+      n = INT_MAX;
+    // leave room for stdio, the script and the descriptors of -j jobs
+    max_stages = n > 32 ? (int)n - 16 : 16;
+  }
+  return max_stages;
+}
+
+/**
+ * @Brief Check that argv (plus the environment) fits in _SC_ARG_MAX
+ *
+ * Counts what execve() copies: every string with its NUL and one pointer
+ * per entry, so an oversized command fails before any stage is started.
+ * The environment's share is kept up to date by the variable table, and
+ * a NAME=value prefix of seg (if any) is added on top.
+ */
+static int argv_fits(char **argv, const Segment *seg)
+{
+  static long arg_max = 0;
+  if (arg_max == 0)
+  {
+    arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0)
+      arg_max = 128 * 1024; // POSIX minimum is 4096; Linux never goes below this
+  }
+
+  size_t total = 0;
+  for (char **a = argv; *a; a++)
+    total += strlen(*a) + 1 + sizeof(char *);
+  vars_envp(&shell_vars); // refreshes env_bytes
+  total += shell_vars.env_bytes;
+  for (int i = 0; seg && i < seg->nassign; i++)
+    total += strlen(seg->assign[i]) + 1 + sizeof(char *);
+  return total <= (size_t)arg_max;
+}
+
+/**
+ * @Brief Environment for an external command of seg
+ *
+ * Without a NAME=value prefix this is the shared block, rebuilt only when
+ * an exported variable changed; with one, a copy in line_arena.
+ */
+static char **segment_envp(const Segment *seg)
+{
+  if (seg->nassign == 0)
+    return vars_envp(&shell_vars);
+  return vars_envp_with(&shell_vars, &line_arena, seg->assign, seg->nassign);
+}
+
+/* A variable as it was before a `NAME=value builtin` prefix */
+typedef struct {
+  char *name;
+  char *value; /* NULL if it was unset */
+  int exported;
+} SavedVar;
+
+/**
+ * @Brief Apply the NAME=value prefix of a builtin run by the shell itself
+ *
+ * The variables are set and exported for the duration of the builtin
+ * (e.g. for `exec`) and put back by restore_assignments.
+ *
+ * @return What to restore, in line_arena (NULL without a prefix)
+ */
+static SavedVar *apply_assignments(const Segment *seg)
+{
+  if (seg->nassign == 0)
+    return NULL;
+  SavedVar *saved = arena_alloc(&line_arena, sizeof(SavedVar) * (size_t)seg->nassign);
+  for (int i = 0; i < seg->nassign; i++)
+  {
+    const char *word = seg->assign[i];
+    saved[i].name = arena_strndup(&line_arena, word, lex_name_len(word));
+    const Var *v = vars_lookup(&shell_vars, saved[i].name);
+    saved[i].value = v ? arena_strndup(&line_arena, v->value, strlen(v->value)) : NULL;
+    saved[i].exported = v ? v->exported : 0;
+    assign_var(seg->assign[i], 1);
+  }
+  return saved;
+}
+
+/**
+ * @Brief Undo apply_assignments (last first, for a name assigned twice)
+ */
+static void restore_assignments(const Segment *seg, const SavedVar *saved)
+{
+  for (int i = seg->nassign - 1; saved && i >= 0; i--)
+  {
+    if (saved[i].value)
+      set_var(saved[i].name, saved[i].value, saved[i].exported);
+    else
+      unset_var(saved[i].name);
+  }
+}
+
+/**
+ * @Brief Replace the shell with an executable (the exec builtin)
+ *
+ * The trace is written first since nothing runs after a successful exec;
+ * recording goes on so a failed exec is traced like any other command.
+ * SIGPIPE is restored in case an in-shell pipeline builtin ignores it;
+ * SIGCHLD's handler is reset by execve itself.
+ *
+ * @return Only if execve failed (errno set)
+ */
+static void exec_replacing_shell(const char *path, char **argv, char **envp)
+{
+  TRACE_BEGIN_CMD("exec", argv[0]);
+  trace_write();
+  fflush(stdout);
+  signal(SIGPIPE, SIG_DFL);
+  execve(path, argv, envp);
+  int saved = errno;
+  TRACE_END("exec");
+  errno = saved;
+}
+
+/**
+ * @Brief Handle exec built-in command
+ *
+ * `exec command args...` replaces the shell with the command; a plain
+ * `exec` does nothing.
+ */
+int builtin_exec(int argc, char **argv)
+{
+  if (argc == 1)
+    return EXIT_SUCCESS;
+  const char *path = resolve_command(argv[1]);
+  if (!path)
+  {
+    warn_not_found(argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (!argv_fits(argv + 1, NULL))
+  {
+    fprintf(stderr, ARG_LIST_TOO_LONG, argv[1]);
+    return EXIT_FAILURE;
+  }
+  exec_replacing_shell(path, argv + 1, vars_envp(&shell_vars));
+  perror("execve");
+  return EXIT_FAILURE;
+}
+
+/**
+ * @Brief Pipe buffer size requested through the WSH_PIPE_SIZE variable
+ *
+ * Accepts a byte count with an optional K or M suffix (e.g. 1M). The
+ * kernel rounds it up to a power of two number of pages and refuses sizes
+ * above /proc/sys/fs/pipe-max-size for unprivileged users.
+ *
+ * @return The size in bytes, or 0 to keep the kernel default
+ */
+static int pipe_size_setting(void)
+{
+  const char *v = vars_get(&shell_vars, "WSH_PIPE_SIZE");
+  if (!v || !*v)
+    return 0;
+  char *end;
+  errno = 0;
+  long size = strtol(v, &end, 10);
+  long multiplier = 1;
+  if (*end == 'k' || *end == 'K')
+    multiplier = 1024, end++;
+  else if (*end == 'm' || *end == 'M')
+    multiplier = 1024 * 1024, end++;
+  // Range check before scaling so a huge value cannot overflow
+  if (errno == ERANGE || *end != '\0' || size <= 0 || size > (1L << 30) / multiplier)
+    return 0;
+  return (int)(size * multiplier);
+}
+
+/**
+ * @Brief Run a builtin pipeline stage inside the shell
+ *
+ * stdout is pointed at out_fd (unless it is -1) for the duration of the
+ * call. SIGPIPE is ignored meanwhile so a reader that exits early (as in
+ * `history | head -1`) turns into a failed write instead of killing the shell.
+ */
+static int run_builtin_in_shell(const Builtin *b, int argc, char **argv, int out_fd)
+{
+  if (b->flags & BI_PIPE_NOOP) // e.g. exit is ignored in a pipeline
+    return EXIT_SUCCESS;
+
+  int saved = -1;
+  void (*old_sigpipe)(int) = SIG_DFL;
+  if (out_fd >= 0)
+  {
+    fflush(stdout);
+    saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (saved < 0 || dup2(out_fd, STDOUT_FILENO) < 0)
+    {
+      perror("dup2");
+      if (saved >= 0)
+        close(saved);
+      return EXIT_FAILURE;
+    }
+    old_sigpipe = signal(SIGPIPE, SIG_IGN);
+  }
+
+  int code = b->handler(argc, argv);
+  fflush(stdout);
+
+  if (saved >= 0)
+  {
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    signal(SIGPIPE, old_sigpipe);
+  }
+  clearerr(stdout);
+  return code;
+}
+
+/**
+ * @Brief Record the started stages of a background pipeline as a job
+ */
+static int start_background_job(const CommandLine *cl, const PipelineStage *stages, int started)
+{
+  pid_t *pids = arena_alloc(&line_arena, sizeof(pid_t) * (size_t)(started + 1));
+  int npids = 0;
+  for (int i = 0; i < started; i++)
+  {
+    if (stages[i].pid > 0)
+      pids[npids++] = stages[i].pid;
+  }
+  if (npids == 0)
+    return EXIT_FAILURE;
+  const Segment *last = &cl->segs[cl->nsegs - 1];
+  size_t len = (size_t)(last->text + last->text_len - cl->line); // without the `&`
+  Job *job = jobs_add(&bg_jobs, cl->line, len, pids, npids);
+  if (interactive)
+    fprintf(stderr, JOB_STARTED, job->id, (int)pids[npids - 1]);
+  return started == cl->nsegs ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @Brief Seconds elapsed since start
+ */
+static double seconds_since(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @Brief Exit code of a wait status, as a shell reports it
+ */
+static int exit_code(int status)
+{
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+}
+
+/**
+ * @Brief Make room for the exit codes of an n-stage line
+ *
+ * @return pipe_status, to be filled with n codes
+ */
+static int *pipe_status_reserve(int n)
+{
+  if (n > cap_pipe_status)
+  {
+    int *grown = realloc(pipe_status, sizeof(int) * (size_t)n);
+    if (!grown)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    pipe_status = grown;
+    cap_pipe_status = n;
+  }
+  n_pipe_status = n;
+  return pipe_status;
+}
+
+/**
+ * @Brief Remember every stage's exit code for `pipestatus`
+ */
+static void record_pipe_status(const PipelineStage *stages, int n)
+{
+  int *codes = pipe_status_reserve(n);
+  for (int i = 0; i < n; i++)
+    codes[i] = exit_code(stages[i].status);
+}
+
+/**
+ * @Brief Record that a stage has been reaped
+ *
+ * With pipecancel, every stage before it that is still running is sent
+ * SIGPIPE: its output can no longer reach the end of the pipeline, and
+ * SIGPIPE is what it would get on its next write anyway.
+ */
+static void stage_finished(PipelineStage *stages, int i, int status, StageUsage *usage)
+{
+  stages[i].status = status;
+  TRACE_CHILD_END(stages[i].pid);
+  if (usage)
+    usage[i].wall = seconds_since(&usage[i].start);
+  if (stages[i].pidfd >= 0)
+    close(stages[i].pidfd); // also drops it from the epoll set
+  stages[i].pidfd = -1;
+  stages[i].pid = 0;
+  if (!opt_pipecancel)
+    return;
+  for (int j = 0; j < i; j++)
+  {
+    if (stages[j].pid <= 0)
+      continue;
+    if (stages[j].pidfd >= 0)
+      pidfd_send_signal(stages[j].pidfd, SIGPIPE, NULL, 0);
+    else
+      kill(stages[j].pid, SIGPIPE);
+  }
+}
+
+/**
+ * @Brief Wait for every child stage of a pipeline
+ *
+ * Each child gets a pidfd in one epoll set, so stages are reaped in the
+ * order they exit: per-stage wall times are exact and pipecancel reacts
+ * as soon as a consumer is gone. Without pidfd support (or for a single
+ * child) the stages are waited for in order.
+ */
+static void reap_stages(PipelineStage *stages, int n, int started, StageUsage *usage)
+{
+  int live = 0;
+  for (int i = 0; i < started; i++)
+  {
+    if (stages[i].pid > 0)
+      live++;
+  }
+  if (opt_pipecancel)
+  { // a builtin that already returned counts as an exited consumer
+    for (int i = n - 1; i >= 0; i--)
+    {
+      if (i < started && stages[i].builtin)
+      {
+        for (int j = 0; j < i; j++)
+        {
+          if (stages[j].pid > 0)
+            kill(stages[j].pid, SIGPIPE);
+        }
+        break;
+      }
+    }
+  }
+
+  int ep = live > 1 ? epoll_create1(EPOLL_CLOEXEC) : -1;
+  for (int i = 0; ep >= 0 && i < started; i++)
+  {
+    if (stages[i].pid <= 0)
+      continue;
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = (uint32_t)i};
+    stages[i].pidfd = pidfd_open(stages[i].pid, 0); // always close-on-exec
+    if (stages[i].pidfd < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, stages[i].pidfd, &ev) != 0)
+    {
+      close(ep);
+      ep = -1;
+    }
+  }
+
+  while (ep >= 0 && live > 0)
+  {
+    struct epoll_event ready[16];
+    int k = epoll_wait(ep, ready, 16, -1);
+    if (k < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      break;
+    }
+    for (int e = 0; e < k; e++)
+    {
+      int i = (int)ready[e].data.u32;
+      int st = 0;
+      if (stages[i].pid <= 0 || wait4(stages[i].pid, &st, WNOHANG, usage ? &usage[i].ru : NULL) <= 0)
+        continue;
+      stage_finished(stages, i, st, usage);
+      live--;
+    }
+  }
+  if (ep >= 0)
+    close(ep);
+
+  // In order, for whatever the epoll loop did not handle
+  for (int i = 0; i < started; i++)
+  {
+    if (stages[i].pid <= 0)
+      continue;
+    int st = 0;
+    wait4(stages[i].pid, &st, 0, usage ? &usage[i].ru : NULL);
+    stage_finished(stages, i, st, usage);
+  }
+}
+
+/**
+ * @Brief Store in d the resources used between two getrusage() calls
+ */
+static void rusage_delta(struct rusage *d, const struct rusage *before, const struct rusage *after)
+{
+  memset(d, 0, sizeof(*d));
+  timersub(&after->ru_utime, &before->ru_utime, &d->ru_utime);
+  timersub(&after->ru_stime, &before->ru_stime, &d->ru_stime);
+  d->ru_maxrss = after->ru_maxrss; // a peak, not a counter
+  d->ru_nvcsw = after->ru_nvcsw - before->ru_nvcsw;
+  d->ru_nivcsw = after->ru_nivcsw - before->ru_nivcsw;
+}
+
+/**
+ * @Brief Run a pipeline command line
+ *
+ * External stages are spawned first. Builtin stages then run in the shell
+ * itself, in order, writing into their pipe; only a state-changing builtin
+ * that is not the last stage still gets a forked child, so `cd` or `path`
+ * as the last stage affects the shell (as in ksh/zsh).
+ *
+ * With cl->background every stage (builtins included) is a child, stdin
+ * comes from /dev/null and the stages are added to the job table instead
+ * of being waited for.
+ *
+ * @param cl The line, one segment per stage
+ * @param stages Scratch space for cl->nsegs stages
+ * @param usage If not NULL, filled with what each stage used (cl->nsegs entries)
+ */
+static int run_pipeline(const CommandLine *cl, PipelineStage *stages, StageUsage *usage)
+{
+  int n = cl->nsegs;
+  int invalid = 0;
+  if (usage)
+    memset(usage, 0, sizeof(StageUsage) * (size_t)n);
+
+  TRACE_BEGIN("pipeline");
+  TRACE_BEGIN("resolve");
+  for (int i = 0; i < n; i++)
+  {
+    const Segment *seg = &cl->segs[i];
+    PipelineStage *st = &stages[i];
+    st->builtin = NULL;
+    st->pid = 0;
+    st->out_fd = -1;
+    st->pidfd = -1;
+    st->status = 127 << 8; // until it has run
+    if (!command_exists(seg->argv, &st->path))
+    {
+      fprintf(stderr, "Command not found or not an executable: %s\n", seg->argv[0]);
+      invalid = 1;
+      continue;
+    }
+    if (st->path)
+    {
+      if (!argv_fits(seg->argv, seg))
+      {
+        fprintf(stderr, ARG_LIST_TOO_LONG, seg->argv[0]);
+        invalid = 1;
+      }
+      continue;
+    }
+    const Builtin *b = builtin_lookup(seg->argv[0]);
+    int mutates = (b->flags & BI_STATE) && !(b->flags & BI_PIPE_NOOP) &&
+                  !(seg->argc == 1 && (b->flags & BI_NOARGS_QUERY));
+    // Inside $(...) a state change stays in a child, like in a subshell
+    if (!cl->background && !(mutates && (i < n - 1 || subst_depth > 0)))
+      st->builtin = b;
+  }
+  TRACE_END("resolve");
+  if (invalid)
+  {
+    if (!cl->background)
+      record_pipe_status(stages, n); // 127 each: nothing was started
+    TRACE_END("pipeline");
+    return EXIT_FAILURE;
+  }
+
+  // Pipes are created one stage at a time, so at most two are open in the
+  // shell (plus the write ends kept for its own builtins). All of them are
+  // O_CLOEXEC: a child only keeps what launch_spawn dup'd onto 0 and 1.
+  int pipe_size = pipe_size_setting();
+  int in_fd = -1;
+  int started = 0;
+  if (cl->background)
+  { // a background job must not read the shell's input
+    in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0)
+      perror("/dev/null");
+  }
+  for (int i = 0; i < n; i++)
+  {
+    PipelineStage *st = &stages[i];
+    int p[2] = {-1, -1};
+    if (i < n - 1)
+    {
+      if (pipe2(p, O_CLOEXEC) == -1)
+      {
+        perror("pipe");
+        break;
+      }
+      if (pipe_size > 0)
+        fcntl(p[1], F_SETPIPE_SZ, pipe_size); // best effort
+    }
+
+    st->out_fd = p[1];
+    if (usage)
+      clock_gettime(CLOCK_MONOTONIC, &usage[i].start);
+    if (!st->builtin)
+    {
+      LaunchIO io = {.in_fd = in_fd, .out_fd = p[1]};
+      TRACE_BEGIN_CMD(st->path ? "spawn" : "fork", cl->segs[i].argv[0]);
+      if (st->path)
+      {
+        st->pid = launch_spawn(st->path, cl->segs[i].argv, segment_envp(&cl->segs[i]), &io);
+        if (st->pid < 0)
+          perror("posix_spawn");
+      }
+      else
+      {
+        st->pid = launch_fork(&io);
+        if (st->pid < 0)
+          perror("fork"); /* parent error */
+        if (st->pid == 0)
+          exec_builtin_in_child(&cl->segs[i]);
+      }
+      TRACE_END(st->path ? "spawn" : "fork");
+      if (st->pid > 0)
+        TRACE_CHILD_START(st->pid, cl->segs[i].argv[0]);
+      if (p[1] >= 0)
+        close(p[1]);
+      st->out_fd = -1;
+    }
+    // Builtins never read stdin, so whatever is written to them hits a closed pipe
+    if (in_fd >= 0)
+      close(in_fd);
+    in_fd = p[0];
+    started = i + 1;
+  }
+  if (in_fd >= 0)
+    close(in_fd);
+
+  if (cl->background)
+  {
+    TRACE_END("pipeline");
+    return start_background_job(cl, stages, started);
+  }
+
+  for (int i = 0; i < started; i++)
+  {
+    PipelineStage *st = &stages[i];
+    if (!st->builtin)
+      continue;
+    struct rusage before, after;
+    if (usage)
+    {
+      // the stages before it are running meanwhile: time the builtin alone
+      getrusage(RUSAGE_SELF, &before);
+      clock_gettime(CLOCK_MONOTONIC, &usage[i].start);
+    }
+    TRACE_BEGIN_CMD("builtin", cl->segs[i].argv[0]);
+    SavedVar *saved = apply_assignments(&cl->segs[i]);
+    int code = run_builtin_in_shell(st->builtin, cl->segs[i].argc, cl->segs[i].argv, st->out_fd);
+    restore_assignments(&cl->segs[i], saved);
+    TRACE_END("builtin");
+    if (usage)
+    {
+      getrusage(RUSAGE_SELF, &after);
+      rusage_delta(&usage[i].ru, &before, &after);
+      usage[i].wall = seconds_since(&usage[i].start);
+    }
+    if (st->out_fd >= 0)
+      close(st->out_fd); // EOF for the next stage
+    st->status = (code & 0xff) << 8; // same encoding as a wait status
+  }
+
+  TRACE_BEGIN("wait");
+  reap_stages(stages, n, started, usage);
+  TRACE_END("wait");
+  TRACE_END("pipeline");
+
+  record_pipe_status(stages, n);
+  int failed = 0;
+  for (int i = opt_pipefail ? 0 : n - 1; i < n; i++)
+  {
+    if (!WIFEXITED(stages[i].status) || WEXITSTATUS(stages[i].status) != 0)
+      failed = 1;
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @Brief Alias value for the command word of a segment, unless it is a
+ * builtin or one of the `used` aliases already expanded on this line
+ *
+ * @param name Set to the alias name (an interned handle) when one is found
+ */
+static const char *segment_alias(const Segment *seg, const char **used, int nused, const char **name)
+{
+  if (seg->argc == 0 || builtin_is_builtin_name(seg->argv[0]))
+    return NULL;
+  const char *key = intern_find(&strings, seg->argv[0], strlen(seg->argv[0]));
+  const char *aval = key ? hm_get_ptr(alias_hm, key) : NULL;
+  for (int i = 0; aval && i < nused; i++)
+  {
+    if (used[i] == key)
+      return NULL;
+  }
+  *name = key;
+  return aval;
+}
+
+/**
+ * @Brief Expand aliases in the command word of every pipeline segment
+ *
+ * The alias value replaces the command word (the first one after any
+ * NAME=value prefix) and the rest of the segment is
+ * kept verbatim, then the result is lexed again (an alias may itself
+ * contain a pipeline). An alias is not expanded a second time on the same
+ * line, so `alias ls = 'ls -l'` terminates.
+ *
+ * @param cl Lexed line, replaced in place when anything was expanded
+ *           (both versions live in the line arena)
+ * @return LEX_OK or the status from lexing the expanded text
+ */
+static LexStatus expand_aliases(CommandLine *cl)
+{
+  const char *used[MAX_ALIAS_DEPTH];
+  int nused = 0;
+
+  while (nused < MAX_ALIAS_DEPTH)
+  {
+    // Size the expanded line; only aliases used in earlier rounds are skipped
+    int prev_used = nused;
+    size_t need = 1;
+    for (int i = 0; i < cl->nsegs; i++)
+    {
+      const Segment *seg = &cl->segs[i];
+      const char *name;
+      const char *aval = segment_alias(seg, used, prev_used, &name);
+      if (aval && nused < MAX_ALIAS_DEPTH)
+      {
+        used[nused++] = name;
+        need += strlen(aval) + seg->text_len - seg->cmd_len;
+      }
+      else
+        need += seg->text_len;
+      need += 3; // " | "
+    }
+    if (nused == prev_used)
+      return LEX_OK;
+
+    char *expanded = arena_alloc(&line_arena, need);
+    char *out = expanded;
+    for (int i = 0; i < cl->nsegs; i++)
+    {
+      const Segment *seg = &cl->segs[i];
+      const char *name;
+      const char *aval = segment_alias(seg, used, prev_used, &name);
+      if (i > 0)
+      {
+        memcpy(out, " | ", 3);
+        out += 3;
+      }
+      if (aval)
+      {
+        size_t alen = strlen(aval);
+        size_t rest = seg->cmd_off + seg->cmd_len;
+        memcpy(out, seg->text, seg->cmd_off);
+        out += seg->cmd_off;
+        memcpy(out, aval, alen);
+        out += alen;
+        memcpy(out, seg->text + rest, seg->text_len - rest);
+        out += seg->text_len - rest;
+      }
+      else
+      {
+        memcpy(out, seg->text, seg->text_len);
+        out += seg->text_len;
+      }
+    }
+
+    int background = cl->background;
+    LexStatus st = lex_line(&line_arena, expanded, (size_t)(out - expanded), max_pipeline_stages(), cl);
+    if (st != LEX_OK)
+      return st;
+    cl->background |= background;
+  }
+  return LEX_OK;
+}
+
+/**
+ * @Brief Print the diagnostic for a line that could not be lexed
+ */
+static void warn_lex_error(LexStatus st)
+{
+  if (st == LEX_MISSING_QUOTE)
+    wsh_warn(MISSING_CLOSING_QUOTE);
+  else if (st == LEX_EMPTY_SEGMENT)
+    wsh_warn(EMPTY_PIPE_SEGMENT);
+  else if (st == LEX_TOO_MANY_SEGMENTS)
+    wsh_warn(TOO_MANY_PIPE_SEGMENTS);
+  else if (st == LEX_UNMATCHED_PAREN)
+    wsh_warn(UNMATCHED_PAREN);
+}
+
+static void run_line(CommandLine *cl, LexStatus st);
+
+/**
+ * @Brief Run the command of a `$(...)` and return what it wrote to stdout
+ *
+ * The command runs in the shell with stdout pointed at a memfd: builtins
+ * write to it without a fork and external stages inherit it. (With a pipe
+ * the shell would be both writer and only reader of a builtin's output,
+ * and would deadlock once that exceeded the pipe buffer.) Each nesting
+ * level reuses its own memfd. The output is read back with large reads
+ * into a buffer grown in line_arena, which nested substitutions share.
+ *
+ * @param cmd Text between `$(` and `)`
+ * @param len Length of cmd
+ * @param out_len Set to the length of the output
+ * @return The output without trailing newlines, NUL terminated
+ */
+static const char *capture_output(const char *cmd, size_t len, size_t *out_len)
+{
+  *out_len = 0;
+  if (subst_depth == MAX_SUBST_DEPTH)
+  {
+    wsh_warn(SUBST_TOO_DEEP);
+    return "";
+  }
+  int fd;
+  if (subst_depth == n_capture_fds)
+  {
+    fd = memfd_create("wsh-subst", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+      perror("memfd_create");
+      return "";
+    }
+    capture_fds[n_capture_fds++] = fd;
+  }
+  else
+  {
+    fd = capture_fds[subst_depth];
+    if (ftruncate(fd, 0) != 0)
+      perror("ftruncate");
+    lseek(fd, 0, SEEK_SET);
+  }
+
+  fflush(stdout);
+  int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+  if (saved < 0 || dup2(fd, STDOUT_FILENO) < 0)
+  {
+    perror("dup2");
+    if (saved >= 0)
+      close(saved);
+    return "";
+  }
+  TRACE_BEGIN("subst");
+  subst_depth++;
+  CommandLine cl;
+  LexStatus st = lex_line(&line_arena, cmd, len, max_pipeline_stages(), &cl);
+  if (st != LEX_EMPTY)
+    run_line(&cl, st);
+  subst_depth--;
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  clearerr(stdout);
+  TRACE_END("subst");
+
+  // Sized from the file, with room to see EOF (or a background writer)
+  struct stat sb;
+  size_t cap = (fstat(fd, &sb) == 0 ? (size_t)sb.st_size : 0) + 4096;
+  char *buf = arena_alloc(&line_arena, cap);
+  size_t n = 0;
+  while (1)
+  {
+    if (n + 1 == cap)
+    {
+      buf = arena_realloc(&line_arena, buf, cap, cap * 2);
+      cap *= 2;
+    }
+    ssize_t r = pread(fd, buf + n, cap - 1 - n, (off_t)n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0)
+      perror("read");
+    if (r <= 0)
+      break;
+    n += (size_t)r;
+  }
+  while (n > 0 && buf[n - 1] == '\n')
+    n--;
+  buf[n] = '\0';
+  *out_len = n;
+  return buf;
+}
+
+/**
+ * @Brief Value of the `$NAME` or `${NAME}` at p
+ *
+ * @param p A `$` followed by a name or `{`
+ * @param next Set to the first byte after the reference
+ * @return The value ("" if unset), or NULL if p is not a valid reference
+ *         (such as `${` without its `}`), which is then kept literally
+ */
+static const char *variable_at(const char *p, const char **next)
+{
+  int braced = p[1] == '{';
+  const char *name = p + 1 + braced;
+  size_t len = lex_name_len(name);
+  if (len == 0 || (braced && name[len] != '}'))
+    return NULL;
+  *next = name + len + braced;
+  const char *value = vars_get(&shell_vars, arena_strndup(&line_arena, name, len));
+  return value ? value : "";
+}
+
+/**
+ * @Brief Replace every `$NAME`, `${NAME}` and `$(...)` of a word
+ */
+static char *expand_word(const char *word)
+{
+  const char *end = word + strlen(word);
+  size_t cap = (size_t)(end - word) + 1;
+  size_t n = 0;
+  char *out = arena_alloc(&line_arena, cap);
+  for (const char *p = word; p < end;)
+  {
+    const char *piece = NULL;
+    size_t len = 0;
+    const char *next;
+    if (p[0] == '$' && p[1] == '(')
+    {
+      const char *close = lex_subst_end(p + 1, end); // matched when lexing
+      piece = capture_output(p + 2, (size_t)(close - p - 2), &len);
+      p = close + 1;
+    }
+    else if (p[0] == '$' && (piece = variable_at(p, &next)) != NULL)
+    {
+      len = strlen(piece);
+      p = next;
+    }
+    else
+    { // literal text up to the next `$`
+      piece = p;
+      next = strchr(p + 1, '$');
+      p = next ? next : end;
+      len = (size_t)(p - piece);
+    }
+    if (n + len + 1 > cap)
+    {
+      size_t grown = n + len + 1 > cap * 2 ? n + len + 1 : cap * 2;
+      out = arena_realloc(&line_arena, out, cap, grown);
+      cap = grown;
+    }
+    memcpy(out + n, piece, len);
+    n += len;
+  }
+  out[n] = '\0';
+  return out;
+}
+
+/* argv being rebuilt by expand_words */
+typedef struct {
+  char **v;
+  int n;
+  int cap;
+} ArgVec;
+
+static void argvec_push(ArgVec *a, char *arg)
+{
+  if (a->n == a->cap)
+  {
+    int cap = a->cap ? a->cap * 2 : 8;
+    a->v = arena_realloc(&line_arena, a->v, sizeof(char *) * (size_t)a->cap, sizeof(char *) * (size_t)cap);
+    a->cap = cap;
+  }
+  a->v[a->n++] = arg;
+}
+
+/**
+ * @Brief Expand the variables and command substitutions of a lexed line
+ *
+ * Each word listed in cl->expand has its `$NAME`, `${NAME}` and `$(...)`
+ * replaced (by the value, or the output of the command) and is then split
+ * on whitespace, so it becomes any number of arguments. The value of a
+ * NAME=value prefix is expanded but not split. Quoted words are never
+ * listed: '$HOME' stays literal.
+ *
+ * @param cl Lexed line; argv of the affected segments are replaced
+ * @return LEX_OK, LEX_EMPTY if a single command expanded to nothing, or
+ *         LEX_EMPTY_SEGMENT if a pipeline stage did
+ */
+static LexStatus expand_words(CommandLine *cl)
+{
+  int k = 0;
+  int tok = 0;
+  for (int i = 0; i < cl->nsegs && k < cl->nexpand; i++)
+  {
+    Segment *seg = &cl->segs[i];
+    for (int j = 0; j < seg->nassign; j++, tok++)
+    {
+      if (k < cl->nexpand && cl->expand[k] == tok)
+      {
+        k++;
+        seg->assign[j] = expand_word(seg->assign[j]);
+      }
+    }
+    if (k == cl->nexpand || cl->expand[k] >= tok + seg->argc)
+    {
+      tok += seg->argc;
+      continue;
+    }
+    ArgVec args = {NULL, 0, 0};
+    for (int j = 0; j < seg->argc; j++, tok++)
+    {
+      if (k == cl->nexpand || cl->expand[k] != tok)
+      {
+        argvec_push(&args, seg->argv[j]);
+        continue;
+      }
+      k++;
+      char *p = expand_word(seg->argv[j]);
+      while (1)
+      {
+        while (isspace((unsigned char)*p))
+          p++;
+        if (!*p)
+          break;
+        argvec_push(&args, p);
+        while (*p && !isspace((unsigned char)*p))
+          p++;
+        if (*p)
+          *p++ = '\0';
+      }
+    }
+    if (args.n == 0 && seg->nassign == 0)
+      return cl->nsegs == 1 ? LEX_EMPTY : LEX_EMPTY_SEGMENT;
+    if (args.n == 0 && cl->nsegs > 1)
+      return LEX_EMPTY_SEGMENT;
+    argvec_push(&args, NULL);
+    seg->argv = args.v;
+    seg->argc = args.n - 1;
+  }
+  return LEX_OK;
+}
+
+/**
+ * @Brief Skip one raw word of a lexed line (same rules as lex_line)
+ */
+static const char *skip_raw_word(const char *p, const char *end)
+{
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  if (p < end && *p == '\'')
+    return (const char *)memchr(p + 1, '\'', (size_t)(end - p - 1)) + 1; // closed, or it would not have lexed
+  while (p < end && !isspace((unsigned char)*p) && *p != '|')
+  {
+    if (*p == '$' && p + 1 < end && p[1] == '(')
+      p = lex_subst_end(p + 1, end); // closed, or it would not have lexed
+    p++;
+  }
+  return p;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @Brief Nearest-rank percentile of n sorted samples
+ */
+static double percentile(const double *sorted, long n, int pct)
+{
+  long rank = (n * pct + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static double tv_seconds(const struct timeval *tv)
+{
+  return (double)tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/**
+ * @Brief Raw text of the command measured by `time [-n N] command...`
+ *
+ * @param cl The lexed line; segs[0].argv[0] is "time"
+ * @param runs Set to N (1 without -n)
+ * @param quiet Do not print the usage message on error
+ * @return The text after the options, or NULL if N is not valid or
+ *         there is no command
+ */
+static const char *timed_text(const CommandLine *cl, long *runs, int quiet)
+{
+  const Segment *seg = &cl->segs[0];
+  int skip = 1;
+  int ok = 1;
+  *runs = 1;
+  if (seg->argc > 2 && strcmp(seg->argv[1], "-n") == 0)
+  {
+    char *endptr;
+    *runs = strtol(seg->argv[2], &endptr, 10);
+    ok = *endptr == '\0' && *runs >= 1 && *runs <= TIME_MAX_RUNS;
+    skip = 3;
+  }
+  if (!ok || seg->argc <= skip)
+  {
+    if (!quiet)
+      fprintf(stderr, INVALID_TIME_USE);
+    return NULL;
+  }
+  const char *p = cl->line;
+  const char *end = cl->line + cl->len;
+  for (int i = 0; i < skip; i++)
+    p = skip_raw_word(p, end);
+  return p;
+}
+
+/**
+ * @Brief Run a line starting with `time [-n N]`
+ *
+ * The rest of the line (a whole pipeline) is lexed and alias-expanded
+ * again, its substitutions are run once, then it is run N times and reported on stderr: one row per stage with wall,
+ * user and sys time, peak RSS and voluntary/involuntary context switches
+ * (means over the runs, RSS is the maximum), then the min/mean/p50/p99 of
+ * the line's wall time when N > 1.
+ *
+ * @param cl The lexed line; segs[0].argv[0] is "time"
+ * @return Status of the last run
+ */
+static int time_command(const CommandLine *cl)
+{
+  long runs;
+  const char *p = timed_text(cl, &runs, 0);
+  if (!p)
+    return EXIT_FAILURE;
+  const char *end = cl->line + cl->len;
+  CommandLine timed;
+  LexStatus st = lex_line(&line_arena, p, (size_t)(end - p), max_pipeline_stages(), &timed);
+  if (st == LEX_OK)
+    st = expand_aliases(&timed);
+  if (st == LEX_OK)
+    st = expand_words(&timed);
+  if (st == LEX_EMPTY)
+    return EXIT_SUCCESS;
+  if (st != LEX_OK)
+  {
+    warn_lex_error(st);
+    return EXIT_FAILURE;
+  }
+  timed.background = 0; // time waits for what it measures
+
+  int n = timed.nsegs;
+  PipelineStage *stages = arena_alloc(&line_arena, sizeof(PipelineStage) * (size_t)n);
+  StageUsage *usage = arena_alloc(&line_arena, sizeof(StageUsage) * (size_t)n);
+  StageUsage *sum = arena_alloc(&line_arena, sizeof(StageUsage) * (size_t)n);
+  memset(sum, 0, sizeof(StageUsage) * (size_t)n);
+  double *samples = malloc(sizeof(double) * (size_t)runs);
+  if (!samples)
+  {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+
+  int code = EXIT_SUCCESS;
+  for (long r = 0; r < runs; r++)
+  {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    code = run_pipeline(&timed, stages, usage);
+    samples[r] = seconds_since(&start);
+    for (int i = 0; i < n; i++)
+    {
+      sum[i].wall += usage[i].wall;
+      timeradd(&sum[i].ru.ru_utime, &usage[i].ru.ru_utime, &sum[i].ru.ru_utime);
+      timeradd(&sum[i].ru.ru_stime, &usage[i].ru.ru_stime, &sum[i].ru.ru_stime);
+      if (usage[i].ru.ru_maxrss > sum[i].ru.ru_maxrss)
+        sum[i].ru.ru_maxrss = usage[i].ru.ru_maxrss;
+      sum[i].ru.ru_nvcsw += usage[i].ru.ru_nvcsw;
+      sum[i].ru.ru_nivcsw += usage[i].ru.ru_nivcsw;
+    }
+  }
+
+  double user = 0, sys = 0, mean = 0;
+  fprintf(stderr, TIME_HEADER, "command", "real", "user", "sys", "maxrss", "vcsw", "ivcsw");
+  for (int i = 0; i < n; i++)
+  {
+    const struct rusage *ru = &sum[i].ru;
+    user += tv_seconds(&ru->ru_utime) / runs;
+    sys += tv_seconds(&ru->ru_stime) / runs;
+    fprintf(stderr, TIME_STAGE, timed.segs[i].argv[0], sum[i].wall / runs, tv_seconds(&ru->ru_utime) / runs,
+            tv_seconds(&ru->ru_stime) / runs, ru->ru_maxrss, (ru->ru_nvcsw + runs / 2) / runs,
+            (ru->ru_nivcsw + runs / 2) / runs);
+  }
+  for (long r = 0; r < runs; r++)
+    mean += samples[r] / runs;
+  if (n > 1)
+    fprintf(stderr, TIME_TOTAL, "total", mean, user, sys);
+  if (runs > 1)
+  {
+    qsort(samples, (size_t)runs, sizeof(double), cmp_double);
+    fprintf(stderr, TIME_RUNS, runs, samples[0], mean, percentile(samples, runs, 50),
+            percentile(samples, runs, 99));
+  }
+  free(samples);
+  return code;
+}
+
+/**
+ * @Brief Run a lexed line: `time`, aliases, substitutions, then the command
+ *
+ * @param cl The line
+ * @param st Status from lexing it (anything but LEX_EMPTY)
+ */
+static void run_line(CommandLine *cl, LexStatus st)
+{
+  if (st == LEX_OK && cl->segs[0].nassign == 0 && strcmp(cl->segs[0].argv[0], "time") == 0)
   {
-    rc = builtin_which(argc, argv);
-    goto cleanup;
+    rc = time_command(cl);
+    return;
   }
-  else if (strcmp(argv[0], "alias") == 0)
+  if (st == LEX_OK)
   {
-    rc = builtin_alias(argc, argv);
-    goto cleanup;
+    TRACE_BEGIN("alias");
+    st = expand_aliases(cl);
+    TRACE_END("alias");
   }
-  else if (strcmp(argv[0], "unalias") == 0)
+  if (st == LEX_OK && cl->nexpand > 0)
+    st = expand_words(cl);
+  if (st == LEX_EMPTY)
+    return; // e.g. `$(true)`: nothing left to run
+  if (st != LEX_OK)
   {
-    rc = builtin_unalias(argc, argv);
-    goto cleanup;
+    warn_lex_error(st);
+    return;
+  }
+
+  Segment *seg = &cl->segs[0];
+  if (seg->argc == 0)
+  { // NAME=value ... on its own sets shell variables
+    for (int i = 0; i < seg->nassign; i++)
+      assign_var(seg->assign[i], VAR_KEEP);
+    rc = EXIT_SUCCESS;
+    return;
   }
-  else if (strcmp(argv[0], "history") == 0)
+
+  // Inside $(...) everything goes through run_pipeline, which keeps state
+  // changes in a child and never replaces the shell
+  if (cl->nsegs > 1 || cl->background || subst_depth > 0)
   {
-    rc = builtin_history(argc, argv);
-    goto cleanup;
+    PipelineStage *stages = arena_alloc(&line_arena, sizeof(PipelineStage) * (size_t)cl->nsegs);
+    rc = run_pipeline(cl, stages, NULL);
+    return;
   }
 
-  char *aval = hm_get(alias_hm, argv[0]);
-  if (aval)
+  int argc = seg->argc;
+  char **argv = seg->argv;
+  const Builtin *b = builtin_lookup(argv[0]);
+  if (b)
   {
-    char *p = line;
-    while (*p && isspace((unsigned char)*p))
-      p++;
-    while (*p && !isspace((unsigned char)*p))
-      p++;          
-    char *rest = p; 
+    TRACE_BEGIN_CMD("builtin", argv[0]);
+    SavedVar *saved = apply_assignments(seg);
+    int code = b->handler(argc, argv);
+    restore_assignments(seg, saved);
+    TRACE_END("builtin");
+    // wait hands back a job's own code: pipestatus keeps it, rc stays 0/1
+    pipe_status_reserve(1)[0] = code;
+    rc = code == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+    return;
+  }
 
-    size_t newlen = strlen(aval) + strlen(rest) + 1;
-    char *expanded = malloc(newlen);
-    if (!expanded)
-    {
-      perror("malloc");
-      clean_exit(EXIT_FAILURE);
-    }
-    strcpy(expanded, aval);
-    strcat(expanded, rest);
-
-    for (int i = 0; i < argc; i++)
-      free(argv[i]);
-    free(line);
-    suppress_history++;
-    process_command(expanded);
-    suppress_history--;
-    free(expanded);
+  // Resolve in the parent so the child can exec without walking PATH again
+  TRACE_BEGIN_CMD("resolve", argv[0]);
+  const char *path = resolve_command(argv[0]);
+  TRACE_END("resolve");
+  if (!path)
+  {
+    warn_not_found(argv[0]);
+    pipe_status_reserve(1)[0] = 127;
+    return;
+  }
+  if (!argv_fits(argv, seg))
+  {
+    wsh_warn(ARG_LIST_TOO_LONG, argv[0]);
     return;
   }
 
-  pid_t pid = fork();
+  char **envp = segment_envp(seg);
+  LaunchIO io = LAUNCH_IO_INHERIT;
+  TRACE_BEGIN_CMD("spawn", argv[0]);
+  pid_t pid = launch_spawn(path, argv, envp, &io);
+  TRACE_END("spawn");
   if (pid < 0)
   {
-    perror("fork");
+    perror("posix_spawn");
     rc = EXIT_FAILURE;
+    return;
   }
-  else if (pid == 0)
+  int status;
+  TRACE_CHILD_START(pid, argv[0]);
+  TRACE_BEGIN("wait");
+  int waited = waitpid(pid, &status, 0);
+  TRACE_END("wait");
+  TRACE_CHILD_END(pid);
+  if (waited == -1)
   {
-    execute_external_command(argv);
+    perror("waitpid");
+    rc = EXIT_FAILURE;
+    return;
   }
+  pipe_status_reserve(1)[0] = exit_code(status);
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    rc = EXIT_SUCCESS;
   else
+    rc = EXIT_FAILURE;
+}
+
+/**
+ * @Brief Run a lexed line and add it to history
+ *
+ * @param cl The line, from lex_line or a compiled script
+ * @param st Its lex status
+ */
+static void process_lexed(CommandLine *cl, LexStatus st)
+{
+  if (st == LEX_MISSING_QUOTE)
+    warn_lex_error(st);
+  if (st == LEX_EMPTY || st == LEX_MISSING_QUOTE) // empty lines are ignored
+    return;
+  if (!suppress_history)
   {
-    int status;
-    if (waitpid(pid, &status, 0) == -1)
-    {
-      perror("waitpid");
-      rc = EXIT_FAILURE;
-    }
-    else
-    {
-      if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
-        rc = EXIT_SUCCESS;
-      else
-        rc = EXIT_FAILURE;
-    }
+    TRACE_BEGIN("history");
+    hist_add(&history, cl->line, cl->len);
+    TRACE_END("history");
   }
+  run_line(cl, st);
+}
 
-cleanup:
-  for (int i = 0; i < argc; i++)
-    free(argv[i]);
-  free(line);
+/**
+ * @Brief Process a command line
+ *
+ * Every temporary made while parsing and expanding the line comes from
+ * line_arena, which is reset in O(1) once the line has run.
+ *
+ * @param cmdline The line (need not be NUL terminated)
+ * @param len Length of the line in bytes
+ */
+void process_command(const char *cmdline, size_t len)
+{
+  if (!cmdline)
+    return;
+
+  TRACE_BEGIN("command");
+  check_jobs();
+  CommandLine cl;
+  TRACE_BEGIN("lex");
+  LexStatus st = lex_line(&line_arena, cmdline, len, max_pipeline_stages(), &cl);
+  TRACE_END("lex");
+  process_lexed(&cl, st);
+  arena_reset(&line_arena);
+  TRACE_END("command");
+}
+
+/**
+ * @Brief Process the next line of a compiled script
+ *
+ * Same as process_command, except that the line was lexed when the
+ * script was compiled: only its segment array is rebuilt.
+ *
+ * @return 1 if a line ran, 0 at the end, -1 if the file is damaged
+ */
+static int process_compiled(CompiledScript *script)
+{
+  TRACE_BEGIN("command");
+  check_jobs();
+  CommandLine cl;
+  LexStatus st;
+  TRACE_BEGIN("load");
+  int got = wshc_next(script, &line_arena, max_pipeline_stages(), &cl, &st);
+  TRACE_END("load");
+  if (got > 0)
+    process_lexed(&cl, st);
+  arena_reset(&line_arena);
+  TRACE_END("command");
+  return got;
 }
 
 /**
@@ -873,6 +2180,7 @@ cleanup:
  */
 void clean_exit(int return_code)
 {
+  trace_flush();
   wsh_free();
   exit(return_code);
 }
@@ -893,6 +2201,32 @@ void wsh_warn(const char *msg, ...)
   rc = EXIT_FAILURE;
 }
 
+/**
+ * @Brief `wsh --compile script [-o out]`: write the compiled script
+ *
+ * The output defaults to the script's name with a `c` appended
+ * (script.wsh -> script.wshc).
+ */
+static int compile_main(int argc, char **argv)
+{
+  if (argc != 3 && !(argc == 5 && strcmp(argv[3], "-o") == 0))
+  {
+    wsh_warn(INVALID_WSH_USE);
+    return EXIT_FAILURE;
+  }
+  char *out = argc == 5 ? strdup(argv[4]) : NULL;
+  if (argc == 3 && asprintf(&out, "%sc", argv[2]) < 0)
+    out = NULL;
+  if (!out)
+  {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+  int result = wshc_compile(argv[2], out) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  free(out);
+  return result;
+}
+
 /**
  * @Brief Main entry point for the shell
  *
@@ -904,188 +2238,491 @@ int main(int argc, char **argv)
 {
   setvbuf(stdout, NULL, _IONBF, 0);
   setvbuf(stderr, NULL, _IONBF, 0);
-  alias_hm = hm_create();
-  history_da = da_create(10);
-  setenv("PATH", "/bin", 1);
-  if (argc > 2)
+  if (argc > 1 && strcmp(argv[1], "--compile") == 0)
+    return compile_main(argc, argv);
+  alias_hm = hm_create_interned_with(free);
+  path_cache_hm = hm_create_interned();
+  const char *histsize = getenv("HISTSIZE");
+  if (histsize && *histsize)
+  { // HISTSIZE=0 turns history off
+    char *endptr;
+    long n = strtol(histsize, &endptr, 10);
+    if (*endptr == '\0' && n >= 0)
+      hist_set_size(&history, (size_t)n);
+  }
+  vars_import(&shell_vars, environ);
+  set_var("PATH", "/bin", 1);
+  trace_init();
+  jobs_init();
+  int jobs = 1;
+  int first = 1; // first non-option argument
+  if (argc > 2 && strcmp(argv[1], "-j") == 0)
+  {
+    char *endptr;
+    long n = strtol(argv[2], &endptr, 10);
+    if (*endptr != '\0' || n < 1 || n > MAX_JOBS || argc != 4)
+    {
+      wsh_warn(INVALID_WSH_USE);
+      return EXIT_FAILURE;
+    }
+    jobs = (int)n;
+    first = 3;
+  }
+  if (argc - first > 1)
   {
     wsh_warn(INVALID_WSH_USE);
     return EXIT_FAILURE;
   }
-  switch (argc)
+  switch (argc - first)
   {
-  case 1:
+  case 0:
     interactive_main();
     break;
-  case 2:
-    rc = batch_main(argv[1]);
+  case 1:
+    rc = batch_main(argv[first], jobs);
     break;
   default:
     break;
   }
-  wsh_free();
-  return rc;
+  clean_exit(rc);
+  return rc; // not reached
 }
 
 /***************************************************
  * Modes of Execution
  ***************************************************/
 
+/**
+ * @Brief Collect executable names for completion
+ */
+static void emit_completion(const char *name, size_t len, void *ctx)
+{
+  le_add_completion(ctx, name, len);
+}
+
+/**
+ * @Brief Completion candidates for the word line[start, end)
+ *
+ * The first word of a pipeline segment completes to builtins, aliases and
+ * executables on PATH (from the trie, which is only rebuilt when PATH or
+ * one of its directories changed); other words, and anything with a '/',
+ * complete to file names.
+ */
+static void complete_line(const char *line, size_t start, size_t end, LeCompletions *out)
+{
+  const char *word = line + start;
+  size_t len = end - start;
+  size_t before = start;
+  while (before > 0 && isspace((unsigned char)line[before - 1]))
+    before--;
+  int command = before == 0 || line[before - 1] == '|';
+  if (!command || memchr(word, '/', len))
+  {
+    le_complete_files(out, word, len);
+    return;
+  }
+
+  for (size_t i = 0; i < sizeof(builtin_table) / sizeof(builtin_table[0]); i++)
+  {
+    if (strncmp(builtin_table[i].name, word, len) == 0)
+      le_add_completion(out, builtin_table[i].name, strlen(builtin_table[i].name));
+  }
+  HashMapIter it;
+  const char *key;
+  void *value;
+  hm_iter_init(&it, alias_hm);
+  while (hm_iter_next(&it, &key, &value))
+  {
+    if (strncmp(key, word, len) == 0)
+      le_add_completion(out, key, strlen(key));
+  }
+  pt_refresh(&exec_trie, vars_get(&shell_vars, "PATH"));
+  pt_complete(&exec_trie, word, len, emit_completion, out);
+}
+
 /**
  * @Brief Interactive mode: print prompt and wait for user input
  * execute the given input and repeat
  */
 void interactive_main(void)
 {
-  // TODO: Implement interactive mode here
-  char line[1024];
+  LineEditor le;
+  Reader in;
+  int editing = le_init(&le, STDIN_FILENO) == 0; // terminal: Ctrl-R search etc.
+  interactive = editing;
+  if (editing)
+  {
+    hist_index(&history); // searches must not wait for an index build
+    le.complete = complete_line;
+  }
+  else
+    reader_init_fd(&in, STDIN_FILENO);
   while (1)
   {
-    printf("wsh> ");
-    fflush(stdout);
-    if (fgets(line, sizeof(line), stdin) == NULL)
+    const char *line;
+    size_t len;
+    int got;
+    check_jobs();
+    if (editing)
     {
-      if (feof(stdin))
-      {
-        printf("\n");
-        clean_exit(rc); // Exit on EOF (Ctrl+D)
-      }
+      got = le_readline(&le, PROMPT, &history, &line, &len);
+    }
+    else
+    {
+      printf(PROMPT);
+      fflush(stdout);
+      got = reader_next(&in, &line, &len);
+    }
+    if (got == 0)
+    {
+      printf("\n");
+      if (editing)
+        le_free(&le);
       else
+        reader_close(&in);
+      clean_exit(rc); // Exit on EOF (Ctrl+D)
+    }
+    if (got < 0)
+    {
+      fprintf(stderr, "read error: %s\n", strerror(errno));
+      continue; // Error reading input, prompt again
+    }
+    process_command(line, len); // Call to helper function to process the command
+  }
+}
+
+/* One in-flight line of a parallel batch run */
+typedef struct {
+  pid_t pid;
+  int out_fd; // memfd collecting the job's stdout
+  int err_fd; // memfd collecting the job's stderr
+  int report_fd; // memfd the job writes its JobReport to before exiting
+} BatchJob;
+
+/* Shell state a job hands back to the shell when it exits */
+typedef struct {
+  unsigned long path_cache_hits; // lookups made by the job itself
+  unsigned long path_cache_misses;
+  int n_pipe_status; // stage codes that follow, -1 if the line left none
+} JobReport;
+
+/* Lines of a parallel batch run: a script read as text, or a compiled one */
+typedef struct {
+  Reader *reader;
+  CompiledScript *compiled;
+} BatchSource;
+
+/**
+ * @Brief Next line of a batch source (see reader_next)
+ */
+static int batch_next(BatchSource *src, const char **line, size_t *len)
+{
+  if (src->reader)
+    return reader_next(src->reader, line, len);
+  return wshc_next_text(src->compiled, line, len);
+}
+
+/**
+ * @Brief Classify a line for parallel batch mode
+ *
+ * @return 0 to skip it (blank), 1 if it may run as a job, 2 if it is a
+ *         barrier that has to run in the shell after all earlier jobs
+ */
+static int classify_batch_line(const char *line, size_t len)
+{
+  CommandLine cl;
+  int kind = 1;
+  LexStatus st = lex_line(&line_arena, line, len, max_pipeline_stages(), &cl);
+  if (st == LEX_EMPTY)
+    kind = 0;
+  const char *typed = st == LEX_EMPTY || st == LEX_MISSING_QUOTE ? NULL : cl.line;
+  long runs;
+  const char *timed = NULL;
+  if (st == LEX_OK && cl.segs[0].nassign == 0 && strcmp(cl.segs[0].argv[0], "time") == 0)
+    timed = timed_text(&cl, &runs, 1);
+  if (timed)
+  { // `time cd dir` changes the shell's cwd just like `cd dir`
+    const char *end = cl.line + cl.len;
+    st = lex_line(&line_arena, timed, (size_t)(end - timed), max_pipeline_stages(), &cl);
+  }
+  if (st == LEX_OK)
+    st = expand_aliases(&cl);
+  if (st == LEX_OK && cl.background)
+    kind = 2; // the job belongs in the shell's own job table
+  for (int i = 0; st == LEX_OK && i < cl.nsegs; i++)
+  {
+    if (cl.segs[i].argc == 0 || builtin_is_barrier(cl.segs[i].argv[0]))
+      kind = 2; // NAME=value on its own sets a shell variable
+  }
+  if (kind == 1 && typed)
+  {
+    // The job's own history is thrown away with it, so keep it here
+    hist_add(&history, typed, strlen(typed));
+  }
+  arena_reset(&line_arena);
+  return kind;
+}
+
+/**
+ * @Brief Copy everything a job wrote into its memfd to fd `to`
+ */
+static void copy_job_output(int from, int to)
+{
+  char buf[64 * 1024];
+  ssize_t n;
+  lseek(from, 0, SEEK_SET);
+  while ((n = read(from, buf, sizeof(buf))) > 0)
+  {
+    for (ssize_t off = 0; off < n;)
+    {
+      ssize_t w = write(to, buf + off, (size_t)(n - off));
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w < 0)
+        return;
+      off += w;
+    }
+  }
+  close(from);
+}
+
+/**
+ * @Brief Wait for a job, replay its output and take over its status
+ */
+static void finish_job(BatchJob *job)
+{
+  int status;
+  while (waitpid(job->pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  TRACE_CHILD_END(job->pid);
+  copy_job_output(job->out_fd, STDOUT_FILENO);
+  copy_job_output(job->err_fd, STDERR_FILENO);
+  JobReport report;
+  if (pread(job->report_fd, &report, sizeof(report), 0) == (ssize_t)sizeof(report))
+  {
+    path_cache_hits += report.path_cache_hits;
+    path_cache_misses += report.path_cache_misses;
+    if (report.n_pipe_status >= 0)
+    {
+      size_t size = sizeof(int) * (size_t)report.n_pipe_status;
+      int *codes = pipe_status_reserve(report.n_pipe_status);
+      if (pread(job->report_fd, codes, size, sizeof(report)) != (ssize_t)size)
+        n_pipe_status = 0;
+    }
+  }
+  close(job->report_fd);
+  if (!WIFEXITED(status))
+    rc = EXIT_FAILURE;
+  else if (WEXITSTATUS(status) != JOB_RC_UNCHANGED)
+    rc = WEXITSTATUS(status);
+}
+
+/**
+ * @Brief Start a line as a job whose output is buffered in memfds
+ *
+ * @return 0 on success, -1 if the job could not be set up
+ */
+static int start_job(BatchJob *job, const char *line, size_t len)
+{
+  job->out_fd = memfd_create("wsh-job-out", MFD_CLOEXEC);
+  job->err_fd = memfd_create("wsh-job-err", MFD_CLOEXEC);
+  job->report_fd = memfd_create("wsh-job-report", MFD_CLOEXEC);
+  if (job->out_fd < 0 || job->err_fd < 0 || job->report_fd < 0)
+  {
+    perror("memfd_create");
+    if (job->out_fd >= 0)
+      close(job->out_fd);
+    if (job->err_fd >= 0)
+      close(job->err_fd);
+    if (job->report_fd >= 0)
+      close(job->report_fd);
+    return -1;
+  }
+  job->pid = fork();
+  if (job->pid < 0)
+  {
+    perror("fork");
+    close(job->out_fd);
+    close(job->err_fd);
+    close(job->report_fd);
+    return -1;
+  }
+  if (job->pid == 0)
+  {
+    trace_disable(); // the job's own phases are not recorded
+    close_capture_fds(); // the shell's own, shared with other jobs
+    dup2(job->out_fd, STDOUT_FILENO);
+    dup2(job->err_fd, STDERR_FILENO);
+    suppress_history = 1;
+    path_cache_hits = 0; // the shell already counted its own lookups
+    path_cache_misses = 0;
+    n_pipe_status = -1; // stays so if the line does not run (e.g. a lex error)
+    rc = -1;
+    process_command(line, len);
+    JobReport report = {path_cache_hits, path_cache_misses, n_pipe_status};
+    size_t size = sizeof(int) * (size_t)(n_pipe_status > 0 ? n_pipe_status : 0);
+    if (write(job->report_fd, &report, sizeof(report)) != (ssize_t)sizeof(report) ||
+        write(job->report_fd, pipe_status, size) != (ssize_t)size)
+      perror("write");
+    _exit(rc == -1 ? JOB_RC_UNCHANGED : rc);
+  }
+  TRACE_CHILD_START(job->pid, "job");
+  return 0;
+}
+
+/**
+ * @Brief Run a script with up to `jobs` lines in flight at once
+ *
+ * Independent lines run as forked jobs whose stdout/stderr are buffered
+ * and replayed in script order, so output and the final status match a
+ * serial run. Lines that change shell state are barriers: they wait for
+ * every earlier job and then run in the shell itself.
+ */
+static int batch_parallel(BatchSource *in, int jobs)
+{
+  BatchJob ring[MAX_JOBS];
+  int head = 0, count = 0; // oldest job, jobs in flight
+  const char *line;
+  size_t len;
+  int got;
+
+  while ((got = batch_next(in, &line, &len)) > 0)
+  {
+    int kind = classify_batch_line(line, len);
+    if (kind == 0)
+      continue;
+    if (kind == 2 || count == jobs)
+    {
+      int keep = kind == 2 ? 0 : jobs - 1;
+      while (count > keep)
       {
-        fprintf(stderr, "fgets error\n");
-        continue; // Error reading input, prompt again
+        finish_job(&ring[head]);
+        head = (head + 1) % jobs;
+        count--;
       }
     }
-    process_command(line); // Call to helper function to process the command
+    if (kind == 2 || start_job(&ring[(head + count) % jobs], line, len) != 0)
+    {
+      process_command(line, len); // barrier (or no job slot): run in the shell
+      continue;
+    }
+    count++;
   }
+  while (count > 0)
+  {
+    finish_job(&ring[head]);
+    head = (head + 1) % jobs;
+    count--;
+  }
+  return got;
 }
 
 /**
- * @Brief Batch mode: read commands from script file line by line
- * execute each command and repeat until EOF
+ * @Brief Run a script read as text
  *
- * @param script_file Path to the script file
- * @return EXIT_SUCCESS(0) on success, EXIT_FAILURE(1) on error
+ * Lines of any length are handed to process_command as views into the
+ * mapped file (or read buffer), without copying them first.
  */
-
-int batch_main(const char *script_file)
+static int batch_text(const char *script_file, int jobs)
 {
-  // TODO: Implement batch mode here
-  FILE *file = fopen(script_file, "r");
-  if (!file)
+  Reader in;
+  if (reader_open(&in, script_file) != 0)
   {
-    perror("fopen");
+    perror("open");
     return EXIT_FAILURE;
   }
-  char line[1024];
-  while (fgets(line, sizeof(line), file))
+  const char *line;
+  size_t len;
+  int got;
+  if (jobs > 1)
+  {
+    BatchSource src = {&in, NULL};
+    got = batch_parallel(&src, jobs);
+  }
+  else
   {
-    process_command(line); // Call to helper function to process the command
+    while ((got = reader_next(&in, &line, &len)) > 0)
+    {
+      process_command(line, len); // Call to helper function to process the command
+    }
   }
-  if (ferror(file))
+  reader_close(&in);
+  if (got < 0)
   {
     fprintf(stderr, "Error reading file: %s\n", strerror(errno));
-    fclose(file);
     return EXIT_FAILURE;
   }
-  fclose(file);
   fflush(stdout);
   return rc;
 }
 
-/***************************************************
- * Parsing
- ***************************************************/
-
 /**
- * @Brief Parse a command line into arguments without doing
- * any alias substitutions.
- * Handles single quotes to allow spaces within arguments.
+ * @Brief Run a compiled script
  *
- * @param cmdline The command line to parse
- * @param argv Array to store the parsed arguments (must be preallocated)
- * @param argc Pointer to store the number of parsed arguments
+ * Serial runs take each line as lexed by `wsh --compile`; parallel runs
+ * lex the stored line text again, as they have to expand aliases to
+ * classify it anyway.
  */
-void parseline_no_subst(const char *cmdline, char **argv, int *argc)
+static int batch_compiled(CompiledScript *script, const char *script_file, int jobs)
 {
-  if (!cmdline)
+  int got;
+  if (jobs > 1)
   {
-    *argc = 0;
-    argv[0] = NULL;
-    return;
+    BatchSource src = {NULL, script};
+    got = batch_parallel(&src, jobs);
   }
-  char *buf = strdup(cmdline);
-  if (!buf)
+  else
   {
-    perror("strdup");
-    clean_exit(EXIT_FAILURE);
+    while ((got = process_compiled(script)) > 0)
+      ;
   }
-  /* Replace trailing newline with space */
-  const size_t len = strlen(buf);
-  if (len > 0 && buf[len - 1] == '\n')
-    buf[len - 1] = ' ';
-  else
+  if (got < 0)
   {
-    char *new_buf = realloc(buf, len + 2);
-    if (!new_buf)
-    {
-      perror("realloc");
-      free(buf);
-      clean_exit(EXIT_FAILURE);
-    }
-    buf = new_buf;
-    strcat(buf, " ");
+    fprintf(stderr, WSHC_DAMAGED, script_file);
+    return EXIT_FAILURE;
   }
+  fflush(stdout);
+  return rc;
+}
 
-  int count = 0;
-  char *p = buf;
-  while (*p && *p == ' ')
-    p++; /* skip leading spaces */
+/**
+ * @Brief Batch mode: read commands from script file line by line
+ * execute each command and repeat until EOF
+ *
+ * A file compiled with `wsh --compile` is mapped and run without lexing,
+ * unless its source has changed since: then the source is run instead.
+ *
+ * @param script_file Path to the script file ("-" for standard input)
+ * @param jobs Maximum number of lines to run at once (1: serial)
+ * @return EXIT_SUCCESS(0) on success, EXIT_FAILURE(1) on error
+ */
+int batch_main(const char *script_file, int jobs)
+{
+  if (strcmp(script_file, "-") == 0)
+    return batch_text(script_file, jobs);
 
-  while (*p)
+  CompiledScript script;
+  int kind = wshc_open(&script, script_file);
+  int result;
+  switch (kind)
   {
-    char *token_start = p;
-    char *token = NULL;
-    if (*p == '\'')
-    {
-      token_start = ++p;
-      token = strchr(p, '\'');
-      if (!token)
-      {
-        /* Handle missing closing quote - Print `Missing closing quote` to stderr */
-        wsh_warn(MISSING_CLOSING_QUOTE);
-        free(buf);
-        for (int i = 0; i < count; i++)
-          free(argv[i]);
-        *argc = 0;
-        argv[0] = NULL;
-        return;
-      }
-      *token = '\0';
-      p = token + 1;
-    }
-    else
-    {
-      token = strchr(p, ' ');
-      if (!token)
-        break;
-      *token = '\0';
-      p = token + 1;
-    }
-    argv[count] = strdup(token_start);
-    if (!argv[count])
-    {
-      perror("strdup");
-      for (int i = 0; i < count; i++)
-        free(argv[i]);
-      free(buf);
-      clean_exit(EXIT_FAILURE);
-    }
-    count++;
-    while (*p && (*p == ' '))
-      p++;
+  case -1:
+    perror("open");
+    return EXIT_FAILURE;
+  case WSHC_NOT_COMPILED:
+    return batch_text(script_file, jobs);
+  case WSHC_OK:
+    result = batch_compiled(&script, script_file, jobs);
+    break;
+  case WSHC_STALE:
+    fprintf(stderr, WSHC_STALE_SOURCE, script_file, wshc_source(&script));
+    result = batch_text(wshc_source(&script), jobs);
+    break;
+  default:
+    fprintf(stderr, WSHC_DAMAGED, script_file);
+    result = EXIT_FAILURE;
+    break;
   }
-  argv[count] = NULL;
-  *argc = count;
-  free(buf);
+  wshc_close(&script);
+  return result;
 }
@@ -4,17 +4,21 @@
 /**************************************************
  * Constants
  *************************************************/
-#define MAX_LINE 1024 /* max line size */
-#define MAX_ARGS 128  /* max args on a command line */
+#define MAX_JOBS 1024 /* max lines in flight with wsh -j N */
 
 #define PROMPT "wsh> " /* prompt */
-#define INVALID_WSH_USE "Invalid usage of wsh. Correct format: wsh | wsh batch_file\n"
+#define INVALID_WSH_USE "Invalid usage of wsh. Correct format: wsh | wsh [-j N] batch_file | wsh [-j N] - | wsh --compile script [-o out]\n"
 
 #define CMD_NOT_FOUND "Command not found or not an executable: %s\n"
 #define EMPTY_PIPE_SEGMENT "Empty command segment in pipeline\n"
+#define TOO_MANY_PIPE_SEGMENTS "Too many commands in pipeline (limited by the open file limit)\n"
+#define ARG_LIST_TOO_LONG "Argument list too long: %s\n"
 #define EMPTY_PATH "PATH empty or not set\n"
 #define MISSING_CLOSING_QUOTE "Missing Closing Quote\n"
 #define UNMATCHED_PAREN "Unmatched parentheses in command substitution\n"
+#define SUBST_TOO_DEEP "Command substitution nested too deeply\n"
+#define WSHC_STALE_SOURCE "%s: %s changed since it was compiled, running the source\n"
+#define WSHC_DAMAGED "%s: damaged or compiled by another version of wsh, compile it again\n"
 
 #define INVALID_PATH_USE "Incorrect usage of path. Correct format: path dir1:dir2:...:dirN\n"
 #define INVALID_EXIT_USE "Incorrect usage of exit. Too many arguments\n"
@@ -22,7 +26,15 @@
 #define INVALID_UNALIAS_USE "Incorrect usage of unalias. Correct format: unalias name\n"
 #define INVALID_WHICH_USE "Incorrect usage of which. Correct format: which name\n"
 #define INVALID_CD_USE "Incorrect usage of cd. Correct format: cd | cd directory\n"
-#define INVALID_HISTORY_USE "Incorrect usage of history. Correct format: history | history n\n"
+#define INVALID_HISTORY_USE "Incorrect usage of history. Correct format: history | history n | history -s text\n"
+#define INVALID_HASH_USE "Incorrect usage of hash. Correct format: hash | hash -r\n"
+#define INVALID_JOBS_USE "Incorrect usage of jobs. Correct format: jobs\n"
+#define INVALID_WAIT_USE "Incorrect usage of wait. Correct format: wait | wait -n | wait %%n ... | wait pid ...\n"
+#define INVALID_SET_USE "Incorrect usage of set. Correct format: set | set -o option | set +o option\n"
+#define INVALID_PIPESTATUS_USE "Incorrect usage of pipestatus. Correct format: pipestatus\n"
+#define INVALID_TIME_USE "Incorrect usage of time. Correct format: time [-n N] command ... (at the start of a line)\n"
+#define INVALID_EXPORT_USE "Incorrect usage of export. Correct format: export | export name[=value] ...\n"
+#define INVALID_UNSET_USE "Incorrect usage of unset. Correct format: unset name ...\n"
 
 #define WHICH_ALIAS "%s: aliased to '%s'\n"
 #define WHICH_BUILTIN "%s: wsh builtin\n"
@@ -30,20 +42,32 @@
 #define WHICH_NOT_FOUND "%s: not found\n"
 
 #define CD_NO_HOME "cd: HOME not set\n"
+#define VAR_NOT_SET "export: %s: not set\n"
 
 #define HISTORY_INVALID_ARG "Invalid argument passed to history\n"
 
+#define HASH_STATS "hash: %lu hits, %lu misses\n"
+
+#define SET_OPTION "set %co %s\n"
+#define SET_UNKNOWN_OPTION "set: unknown option: %s (options: pipefail, pipecancel)\n"
+
+#define JOB_STARTED "[%d] %d\n"
+#define JOB_RUNNING "[%d]  Running   %s &\n"
+#define JOB_DONE "[%d]  Done      %s\n"
+#define JOB_EXIT "[%d]  Exit %-4d %s\n"
+#define NO_SUCH_JOB "wait: no such job: %s\n"
+
+#define TIME_MAX_RUNS 1000000 /* upper bound for time -n */
+#define TIME_HEADER "%-16s %10s %10s %10s %10s %8s %8s\n"
+#define TIME_STAGE "%-16.16s %9.6fs %9.6fs %9.6fs %9ldK %8ld %8ld\n"
+#define TIME_TOTAL "%-16s %9.6fs %9.6fs %9.6fs\n"
+#define TIME_RUNS "%ld runs: min %.6fs mean %.6fs p50 %.6fs p99 %.6fs\n"
+
 /**************************************************
  * Modes of Execution
  *************************************************/
 void interactive_main(void); /* Print prompt and wait for user input */
-int batch_main(const char *script_file); /* Read a commands from script_file line by line */
-
-/**************************************************
- * Parsing
- *************************************************/
-void parseline_no_subst(const char *cmdline, char **argv, int *argc);
-
+int batch_main(const char *script_file, int jobs); /* Read a commands from script_file ("-" = stdin, or a compiled .wshc) line by line, up to jobs at once */
 
 /**************************************************
  * Helpers
@@ -12,6 +12,12 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+/* wsh2 keeps the original fixed-size parser and fgets() batch loop; it is
+ * built as a baseline for `make bench` */
+#define MAX_ARGS 128
+static int batch_file_main(const char *script_file);
+void parseline_no_subst(const char *cmdline, char **argv, int *argc);
+
 int rc;
 HashMap *alias_hm = NULL;
 DynamicArray *history_da = NULL;
@@ -602,7 +608,7 @@ int main(int argc, char **argv)
     interactive_main();
     break;
   case 2:
-    rc = batch_main(argv[1]);
+    rc = batch_file_main(argv[1]);
     break;
   default:
     break;
@@ -652,7 +658,7 @@ void interactive_main(void)
  * @return EXIT_SUCCESS(0) on success, EXIT_FAILURE(1) on error
  */
 
-int batch_main(const char *script_file)
+static int batch_file_main(const char *script_file)
 {
   // TODO: Implement batch mode here
   FILE *file = fopen(script_file, "r");
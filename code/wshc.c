@@ -0,0 +1,565 @@
+#include "wshc.h"
+#include "hash_map.h"
+#include "intern.h"
+#include "reader.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+/* Growable byte buffer for one table of the file being written */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} Buf;
+
+/* State of one compilation */
+typedef struct {
+  Buf lines, segs, words, expand, pool;
+  InternTable strings;  /* every distinct string once */
+  HashMap *offsets;     /* interned string -> its uint64_t pool offset */
+  Arena arena;          /* lexer output (reset per line) */
+  Arena offset_store;   /* the pool offsets */
+} Compiler;
+
+/**
+ * @Brief Append n bytes to a buffer
+ */
+static void buf_append(Buf *b, const void *data, size_t n)
+{
+  if (b->len + n > b->cap)
+  {
+    size_t cap = b->cap ? b->cap * 2 : 4096;
+    while (cap < b->len + n)
+      cap *= 2;
+    char *grown = realloc(b->data, cap);
+    if (!grown)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    b->data = grown;
+    b->cap = cap;
+  }
+  memcpy(b->data + b->len, data, n);
+  b->len += n;
+}
+
+/**
+ * @Brief FNV-1a of n bytes, continuing from h
+ */
+static uint64_t fnv1a(uint64_t h, const char *p, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    h ^= (unsigned char)p[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+/**
+ * @Brief Hash the whole content of an open regular file
+ *
+ * @return 0 on success, -1 (errno set) if it cannot be mapped
+ */
+static int hash_file(int fd, size_t size, uint64_t *hash)
+{
+  *hash = FNV_OFFSET;
+  if (size == 0)
+    return 0;
+  char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  madvise(map, size, MADV_SEQUENTIAL);
+  *hash = fnv1a(FNV_OFFSET, map, size);
+  munmap(map, size);
+  return 0;
+}
+
+/**
+ * @Brief Pool offset of a string, adding it on first use
+ *
+ * Identical strings (command names, arguments, whole lines) share one
+ * copy, so a generated script repeating the same command stays small.
+ */
+static uint64_t pool_string(Compiler *c, const char *s, size_t len)
+{
+  const char *handle = intern(&c->strings, s, len);
+  uint64_t *off = hm_get_ptr(c->offsets, handle);
+  if (!off)
+  {
+    off = arena_alloc(&c->offset_store, sizeof(uint64_t));
+    *off = c->pool.len;
+    buf_append(&c->pool, s, len);
+    buf_append(&c->pool, "", 1);
+    hm_put_ptr(c->offsets, handle, off);
+  }
+  return *off;
+}
+
+/**
+ * @Brief Record a lexed line (and its segments and words)
+ *
+ * @param c The compiler
+ * @param src The source line, for lines lex_line kept no copy of
+ * @param len Length of src
+ * @param cl The lexed line
+ * @param st Status from lex_line
+ */
+static void add_line(Compiler *c, const char *src, size_t len, const CommandLine *cl, LexStatus st)
+{
+  WshcLine l;
+  memset(&l, 0, sizeof(l));
+  if (st == LEX_MISSING_QUOTE)
+  { // trim as lex_line does, for `wsh -j`
+    while (len && isspace((unsigned char)*src))
+    {
+      src++;
+      len--;
+    }
+    while (len && isspace((unsigned char)src[len - 1]))
+      len--;
+    l.text = pool_string(c, src, len);
+    l.text_len = len;
+  }
+  else
+  {
+    l.text = pool_string(c, cl->line, cl->len);
+    l.text_len = cl->len;
+  }
+  l.status = (uint32_t)st;
+  l.first_seg = c->segs.len / sizeof(WshcSeg);
+  l.first_expand = c->expand.len / sizeof(int32_t);
+  if (st == LEX_OK)
+  {
+    l.nsegs = (uint32_t)cl->nsegs;
+    l.nexpand = (uint32_t)cl->nexpand;
+    l.background = (uint32_t)cl->background;
+    for (int i = 0; i < cl->nsegs; i++)
+    {
+      const Segment *seg = &cl->segs[i];
+      WshcSeg ws;
+      memset(&ws, 0, sizeof(ws));
+      ws.first_word = c->words.len / sizeof(uint64_t);
+      ws.text_off = (uint64_t)(seg->text - cl->line);
+      ws.text_len = seg->text_len;
+      ws.cmd_off = seg->cmd_off;
+      ws.cmd_len = seg->cmd_len;
+      ws.argc = (uint32_t)seg->argc;
+      ws.nassign = (uint32_t)seg->nassign;
+      for (int j = 0; j < seg->nassign + seg->argc; j++)
+      { // assign and argv are one array
+        uint64_t off = pool_string(c, seg->assign[j], strlen(seg->assign[j]));
+        buf_append(&c->words, &off, sizeof(off));
+      }
+      buf_append(&c->segs, &ws, sizeof(ws));
+    }
+    for (int i = 0; i < cl->nexpand; i++)
+    {
+      int32_t tok = cl->expand[i];
+      buf_append(&c->expand, &tok, sizeof(tok));
+    }
+  }
+  buf_append(&c->lines, &l, sizeof(l));
+}
+
+/**
+ * @Brief Write all n bytes of data
+ */
+static int write_all(int fd, const void *data, size_t n)
+{
+  const char *p = data;
+  while (n > 0)
+  {
+    ssize_t w = write(fd, p, n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0)
+      return -1;
+    p += w;
+    n -= (size_t)w;
+  }
+  return 0;
+}
+
+/**
+ * @Brief Append one table to the file, padded to 8 bytes
+ */
+static int write_table(int fd, const Buf *b, uint64_t *off)
+{
+  static const char zeros[8];
+  if (write_all(fd, b->data, b->len) != 0)
+    return -1;
+  size_t pad = (8 - b->len % 8) % 8;
+  *off += b->len + pad;
+  return write_all(fd, zeros, pad);
+}
+
+/**
+ * @Brief Write the header and tables to out through a temporary file
+ *
+ * The file is renamed over out only once complete, so a wsh that has the
+ * old version mapped keeps running it undisturbed.
+ */
+static int write_compiled(Compiler *c, WshcHeader *h, const char *out)
+{
+  Buf *tables[] = {&c->lines, &c->segs, &c->words, &c->expand, &c->pool};
+  uint64_t *offs[] = {&h->lines_off, &h->segs_off, &h->words_off, &h->expand_off, &h->pool_off};
+  uint64_t off = sizeof(WshcHeader);
+  for (int i = 0; i < 5; i++)
+  {
+    *offs[i] = off;
+    off += (tables[i]->len + 7) & ~(size_t)7;
+  }
+
+  size_t out_len = strlen(out);
+  char *tmp = malloc(out_len + sizeof(".tmp"));
+  if (!tmp)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(tmp, out, out_len);
+  memcpy(tmp + out_len, ".tmp", sizeof(".tmp"));
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0)
+  {
+    perror(tmp);
+    free(tmp);
+    return -1;
+  }
+  int failed = write_all(fd, h, sizeof(*h)) != 0;
+  off = sizeof(WshcHeader);
+  for (int i = 0; i < 5 && !failed; i++)
+    failed = write_table(fd, tables[i], &off) != 0;
+  if (close(fd) != 0)
+    failed = 1;
+  if (!failed && rename(tmp, out) != 0)
+    failed = 1;
+  if (failed)
+  {
+    perror(out);
+    unlink(tmp);
+  }
+  free(tmp);
+  return failed ? -1 : 0;
+}
+
+/**
+ * @Brief Compile a script
+ *
+ * Every line is lexed once, exactly as batch mode would (alias and `$`
+ * expansion still happen when it runs, since they depend on shell state).
+ * The source's size, mtime and hash are stored so a stale file is noticed.
+ *
+ * @param src Path of the script (a regular file)
+ * @param out Path of the compiled file
+ * @return 0 on success, -1 on error (reported on stderr)
+ */
+int wshc_compile(const char *src, const char *out)
+{
+  int fd = open(src, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    perror(src);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  char *abs_src = realpath(src, NULL);
+  if (!S_ISREG(st.st_mode) || !abs_src)
+  {
+    if (!abs_src)
+      perror(src);
+    else
+      fprintf(stderr, "%s: not a regular file\n", src);
+    free(abs_src);
+    close(fd);
+    return -1;
+  }
+
+  WshcHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, WSHC_MAGIC, sizeof(h.magic));
+  h.version = WSHC_VERSION;
+  h.byte_order = WSHC_BYTE_ORDER;
+  h.src_size = (uint64_t)st.st_size;
+  h.src_mtime_sec = st.st_mtim.tv_sec;
+  h.src_mtime_nsec = st.st_mtim.tv_nsec;
+  if (hash_file(fd, (size_t)st.st_size, &h.src_hash) != 0)
+  {
+    perror("mmap");
+    free(abs_src);
+    close(fd);
+    return -1;
+  }
+
+  Compiler c;
+  memset(&c, 0, sizeof(c));
+  c.strings = (InternTable)INTERN_TABLE_INIT;
+  c.offsets = hm_create_interned();
+  c.arena = (Arena)ARENA_INIT(16 * 1024);
+  c.offset_store = (Arena)ARENA_INIT(16 * 1024);
+  h.src_path = pool_string(&c, abs_src, strlen(abs_src));
+  free(abs_src);
+
+  Reader in;
+  reader_init_fd(&in, fd);
+  const char *line;
+  size_t len;
+  int got;
+  while ((got = reader_next(&in, &line, &len)) > 0)
+  {
+    CommandLine cl;
+    LexStatus lst = lex_line(&c.arena, line, len, 0, &cl);
+    if (lst != LEX_EMPTY)
+      add_line(&c, line, len, &cl, lst);
+    arena_reset(&c.arena);
+  }
+  if (got < 0)
+    perror(src);
+  reader_close(&in);
+  close(fd);
+
+  h.nlines = c.lines.len / sizeof(WshcLine);
+  h.nsegs = c.segs.len / sizeof(WshcSeg);
+  h.nwords = c.words.len / sizeof(uint64_t);
+  h.nexpand = c.expand.len / sizeof(int32_t);
+  h.pool_len = c.pool.len;
+  int result = got < 0 ? -1 : write_compiled(&c, &h, out);
+
+  Buf *tables[] = {&c.lines, &c.segs, &c.words, &c.expand, &c.pool};
+  for (int i = 0; i < 5; i++)
+    free(tables[i]->data);
+  hm_free(c.offsets);
+  intern_free(&c.strings);
+  arena_free(&c.arena);
+  arena_free(&c.offset_store);
+  return result;
+}
+
+/**
+ * @Brief Whether a table of n entries of size bytes at off lies inside the map
+ */
+static int table_fits(const CompiledScript *s, uint64_t off, uint64_t n, size_t size)
+{
+  return off % 8 == 0 && off <= s->map_len && n <= (s->map_len - off) / size;
+}
+
+/**
+ * @Brief Check the header and locate the tables
+ */
+static int header_valid(CompiledScript *s)
+{
+  const WshcHeader *h = s->hdr;
+  if (s->map_len < sizeof(WshcHeader) || h->version != WSHC_VERSION || h->byte_order != WSHC_BYTE_ORDER)
+    return 0;
+  if (!table_fits(s, h->lines_off, h->nlines, sizeof(WshcLine)) ||
+      !table_fits(s, h->segs_off, h->nsegs, sizeof(WshcSeg)) ||
+      !table_fits(s, h->words_off, h->nwords, sizeof(uint64_t)) ||
+      !table_fits(s, h->expand_off, h->nexpand, sizeof(int32_t)) ||
+      !table_fits(s, h->pool_off, h->pool_len, 1))
+    return 0;
+  s->lines = (const WshcLine *)(s->map + h->lines_off);
+  s->segs = (const WshcSeg *)(s->map + h->segs_off);
+  s->words = (const uint64_t *)(s->map + h->words_off);
+  s->expand = (int32_t *)(s->map + h->expand_off);
+  s->pool = s->map + h->pool_off;
+  // A NUL at the very end keeps every pool string inside the map
+  return h->pool_len > 0 && s->pool[h->pool_len - 1] == '\0' && h->src_path < h->pool_len;
+}
+
+/**
+ * @Brief Whether the source still matches what was compiled
+ *
+ * Same size and mtime is enough; a different mtime (a fresh checkout, a
+ * `touch`) falls back to hashing the content. A source that is gone is
+ * not stale: the compiled file stands on its own.
+ */
+static int source_current(const CompiledScript *s)
+{
+  const WshcHeader *h = s->hdr;
+  int fd = open(wshc_source(s), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return errno == ENOENT;
+  struct stat st;
+  int current = 0;
+  if (fstat(fd, &st) == 0 && (uint64_t)st.st_size == h->src_size)
+  {
+    uint64_t hash;
+    current = (st.st_mtim.tv_sec == h->src_mtime_sec && st.st_mtim.tv_nsec == h->src_mtime_nsec) ||
+              (hash_file(fd, (size_t)st.st_size, &hash) == 0 && hash == h->src_hash);
+  }
+  close(fd);
+  return current;
+}
+
+/**
+ * @Brief Open a compiled script
+ *
+ * The mapping is private and writable: the shell may briefly write into a
+ * word (e.g. to split NAME=value), which then copies only that page and
+ * never reaches the file.
+ *
+ * @param s Set up for wshc_next
+ * @param path The file
+ * @return A WshcStatus, or -1 (errno set) if it cannot be read
+ */
+int wshc_open(CompiledScript *s, const char *path)
+{
+  memset(s, 0, sizeof(*s));
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  char magic[sizeof(WSHC_MAGIC) - 1];
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      pread(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) ||
+      memcmp(magic, WSHC_MAGIC, sizeof(magic)) != 0)
+  {
+    close(fd);
+    return WSHC_NOT_COMPILED;
+  }
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  s->map = map;
+  s->map_len = (size_t)st.st_size;
+  s->hdr = map;
+  if (!header_valid(s))
+    return WSHC_BAD;
+  return source_current(s) ? WSHC_OK : WSHC_STALE;
+}
+
+/**
+ * @Brief Absolute path of the source script
+ */
+const char *wshc_source(const CompiledScript *s)
+{
+  return s->pool + s->hdr->src_path;
+}
+
+/**
+ * @Brief Whether a line's text lies inside the pool
+ */
+static int text_valid(const CompiledScript *s, const WshcLine *l)
+{
+  return l->text < s->hdr->pool_len && l->text_len < s->hdr->pool_len - l->text;
+}
+
+/**
+ * @Brief Load the next line into a CommandLine
+ *
+ * Only the segment array and argv vectors are built (from the arena);
+ * the line, words and expansion list are used in place.
+ *
+ * @param s The script
+ * @param arena Allocator for the segments
+ * @param max_segs Pipeline length limit (<= 0: unlimited)
+ * @param cl Output, as lex_line would fill it
+ * @param st Output, as lex_line would return it
+ * @return 1 for a line, 0 at the end, -1 if the file is damaged
+ */
+int wshc_next(CompiledScript *s, Arena *arena, int max_segs, CommandLine *cl, LexStatus *st)
+{
+  const WshcHeader *h = s->hdr;
+  if (s->next >= h->nlines)
+    return 0;
+  const WshcLine *l = &s->lines[s->next++];
+  if (!text_valid(s, l) || l->first_seg > h->nsegs || l->nsegs > h->nsegs - l->first_seg ||
+      l->first_expand > h->nexpand || l->nexpand > h->nexpand - l->first_expand)
+    return -1;
+
+  memset(cl, 0, sizeof(*cl));
+  cl->line = s->pool + l->text;
+  cl->len = l->text_len;
+  *st = (LexStatus)l->status;
+  if (*st != LEX_OK)
+    return 1;
+  if (max_segs > 0 && l->nsegs > (uint32_t)max_segs)
+  {
+    *st = LEX_TOO_MANY_SEGMENTS;
+    return 1;
+  }
+
+  const WshcSeg *ws = &s->segs[l->first_seg];
+  size_t nwords = 0;
+  for (uint32_t i = 0; i < l->nsegs; i++)
+  {
+    uint64_t n = (uint64_t)ws[i].nassign + ws[i].argc;
+    if (ws[i].first_word > h->nwords || n > h->nwords - ws[i].first_word ||
+        ws[i].text_off > l->text_len || ws[i].text_len > l->text_len - ws[i].text_off ||
+        ws[i].cmd_off > ws[i].text_len || ws[i].cmd_len > ws[i].text_len - ws[i].cmd_off)
+      return -1;
+    nwords += n + 1;
+  }
+
+  // One block for the segments and every argv, as lex_line lays them out
+  size_t seg_bytes = sizeof(Segment) * l->nsegs;
+  Segment *segs = arena_alloc(arena, seg_bytes + sizeof(char *) * nwords);
+  char **argv = (char **)((char *)segs + seg_bytes);
+  for (uint32_t i = 0; i < l->nsegs; i++)
+  {
+    Segment *seg = &segs[i];
+    seg->assign = argv;
+    seg->argv = argv + ws[i].nassign;
+    seg->argc = (int)ws[i].argc;
+    seg->nassign = (int)ws[i].nassign;
+    seg->text = cl->line + ws[i].text_off;
+    seg->text_len = ws[i].text_len;
+    seg->cmd_off = ws[i].cmd_off;
+    seg->cmd_len = ws[i].cmd_len;
+    const uint64_t *word = &s->words[ws[i].first_word];
+    for (uint32_t j = 0; j < ws[i].nassign + ws[i].argc; j++)
+    {
+      if (word[j] >= h->pool_len)
+        return -1;
+      *argv++ = s->pool + word[j];
+    }
+    *argv++ = NULL;
+  }
+  cl->segs = segs;
+  cl->nsegs = (int)l->nsegs;
+  cl->seg_cap = cl->nsegs;
+  cl->background = (int)l->background;
+  cl->expand = s->expand + l->first_expand;
+  cl->nexpand = (int)l->nexpand;
+  return 1;
+}
+
+/**
+ * @Brief Next line as text, for runs that lex lines themselves
+ */
+int wshc_next_text(CompiledScript *s, const char **line, size_t *len)
+{
+  if (s->next >= s->hdr->nlines)
+    return 0;
+  const WshcLine *l = &s->lines[s->next++];
+  if (!text_valid(s, l))
+    return -1;
+  *line = s->pool + l->text;
+  *len = l->text_len;
+  return 1;
+}
+
+/**
+ * @Brief Unmap a compiled script
+ */
+void wshc_close(CompiledScript *s)
+{
+  if (s->map)
+    munmap(s->map, s->map_len);
+  memset(s, 0, sizeof(*s));
+}
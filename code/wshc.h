@@ -0,0 +1,104 @@
+#ifndef WSHC_H
+#define WSHC_H
+
+#include "arena.h"
+#include "lexer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Compiled scripts (`wsh --compile script.wsh -o script.wshc`): every line
+// lexed ahead of time into a pipeline of segments whose words are offsets
+// into a pool of deduplicated strings. Nothing in the file is a pointer,
+// so it is mmap'd and used in place.
+
+#define WSHC_MAGIC "WSHC"
+#define WSHC_VERSION 1            // bump when the format or the lexer changes
+#define WSHC_BYTE_ORDER 0x01020304u
+
+// File header; the tables follow it, each 8-byte aligned
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;      // WSHC_BYTE_ORDER as stored by the compiler
+    uint32_t reserved;
+    uint64_t src_size;        // source script when it was compiled
+    int64_t src_mtime_sec;
+    int64_t src_mtime_nsec;
+    uint64_t src_hash;        // FNV-1a of the whole source
+    uint64_t src_path;        // pool offset of the source's absolute path
+    uint64_t nlines, lines_off;
+    uint64_t nsegs, segs_off;
+    uint64_t nwords, words_off;  // uint64_t pool offsets
+    uint64_t nexpand, expand_off; // int32_t word indices (CommandLine.expand)
+    uint64_t pool_len, pool_off;  // NUL terminated strings
+} WshcHeader;
+
+// One non-blank line of the source
+typedef struct {
+    uint64_t text;            // pool offset of the trimmed line
+    uint64_t text_len;
+    uint64_t first_seg;
+    uint64_t first_expand;
+    uint32_t nsegs;
+    uint32_t nexpand;
+    uint32_t status;          // LexStatus from compiling it
+    uint32_t background;
+} WshcLine;
+
+// One pipeline segment: nassign assignments, then argc words
+typedef struct {
+    uint64_t first_word;
+    uint64_t text_off;        // Segment.text, relative to the line
+    uint64_t text_len;
+    uint64_t cmd_off;
+    uint64_t cmd_len;
+    uint32_t argc;            // assignments excluded
+    uint32_t nassign;
+} WshcSeg;
+
+// An open compiled script
+typedef struct {
+    char *map;
+    size_t map_len;
+    const WshcHeader *hdr;
+    const WshcLine *lines;
+    const WshcSeg *segs;
+    const uint64_t *words;
+    int32_t *expand;          // writable like the pool: CommandLine.expand is int *
+    char *pool;
+    uint64_t next;            // index of the next line
+} CompiledScript;
+
+// Result of wshc_open
+typedef enum {
+    WSHC_OK = 0,
+    WSHC_NOT_COMPILED,        // no WSHC header: an ordinary script
+    WSHC_STALE,               // the source changed since it was compiled
+    WSHC_BAD                  // wrong version or damaged
+} WshcStatus;
+
+// Compile the script at src into out (replaced atomically). Returns 0, or
+// -1 after printing why.
+int wshc_compile(const char *src, const char *out);
+
+// Map path and check it against its source. Returns a WshcStatus, or -1
+// with errno set if path cannot be read. Unless it is -1 or
+// WSHC_NOT_COMPILED, s must be closed with wshc_close.
+int wshc_open(CompiledScript *s, const char *path);
+
+// Path of the script s was compiled from (WSHC_OK and WSHC_STALE only)
+const char *wshc_source(const CompiledScript *s);
+
+// Next line as lex_line would have returned it for a max_segs limit;
+// segments and argv come from arena, the strings are in the mapping.
+// Returns 1 with *st set, 0 at the end, -1 if the file is damaged.
+int wshc_next(CompiledScript *s, Arena *arena, int max_segs, CommandLine *cl, LexStatus *st);
+
+// Next line as text (for wsh -j). Returns 1, 0 at the end, or -1 if the
+// file is damaged.
+int wshc_next_text(CompiledScript *s, const char **line, size_t *len);
+
+// Unmap the file
+void wshc_close(CompiledScript *s);
+
+#endif // WSHC_H